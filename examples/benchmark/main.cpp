@@ -0,0 +1,16 @@
+#include "nano/test.h"
+
+namespace {
+BENCHMARK_CASE("Example", Accumulate, "Sum of 1024 ints") {
+  static const std::vector<int> values(1024, 1);
+  nano::test::do_not_optimize(std::accumulate(values.begin(), values.end(), 0));
+}
+
+BENCHMARK_CASE("Example", StringCopy) {
+  static const std::string str(64, 'a');
+  std::string copy = str;
+  nano::test::do_not_optimize(copy);
+}
+} // namespace.
+
+NANO_TEST_MAIN()
@@ -0,0 +1,92 @@
+// Exercises the runner options, every test passes by default:
+//
+//   nano-test-runner --jobs 4
+//   nano-test-runner --shards 2 --report-file report.xml
+//   nano-test-runner --filter 'Io\-Read.*' --list-tests
+//   nano-test-runner --tags slow
+//   nano-test-runner --shard-index 0 --shard-count 2
+//   nano-test-runner --incremental --cache-key v1
+//   nano-test-runner --timeout 10 --journal results.journal
+//
+// With NANO_TEST_EXAMPLE_FAILURES=1 the tests of the "Runner-Failures" group fail instead:
+// a check on an unbound thread under --jobs, a crash under --jobs or --shards and a timeout.
+//
+//   NANO_TEST_EXAMPLE_FAILURES=1 nano-test-runner --jobs 4 --filter 'Runner\-Failures.UnboundThread'
+//   NANO_TEST_EXAMPLE_FAILURES=1 nano-test-runner --jobs 4 --filter 'Runner\-Failures.Crash:Runner.*'
+//   NANO_TEST_EXAMPLE_FAILURES=1 nano-test-runner --shards 2 --report-file report.json --report-format json
+#include "nano/test.h"
+
+#include <cstdlib>
+#include <thread>
+
+namespace {
+inline bool failures_enabled() {
+  const char* value = std::getenv("NANO_TEST_EXAMPLE_FAILURES");
+  return value && std::string(value) == "1";
+}
+
+/// Golden files are stored next to this source file.
+inline std::string golden_path(const char* name) {
+  std::string path = __FILE__;
+  path.erase(path.find_last_of("/\\") + 1);
+  return path + "golden/" + name;
+}
+
+inline std::string greeting(const std::string& name) { return "Hello, " + name + "!\n"; }
+
+TEST_CASE("Io-Read", Lines, "Reads lines [io]") {
+  const std::string text = "a\nb\nc\n";
+  EXPECT_EQ(std::count(text.begin(), text.end(), '\n'), 3);
+}
+
+TEST_CASE("Io-Read", Golden, "Compares with a golden file, --update-golden rewrites it [io]") {
+  EXPECT_MATCHES_GOLDEN(greeting("nano"), golden_path("greeting.txt").c_str());
+}
+
+TEST_CASE("Io-Write", Append, "Appends to a string [io]") {
+  std::string text = "a";
+  text += "b";
+  EXPECT_STR_EQ(text.c_str(), "ab");
+}
+
+TEST_CASE("Runner", Threads, "Checks on spawned threads, bound to the test [threads]") {
+  nano::test::test_context test = nano::test::current_test();
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(std::thread([test, i] {
+      nano::test::test_scope scope(test);
+      EXPECT_GE(i, 0);
+    }));
+  }
+
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+TEST_CASE("Runner", Slow, "Sleeps within its own timeout [slow]", NANO_TEST_TIMEOUT(10)) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_TRUE(true);
+}
+
+TEST_CASE("Runner-Failures", UnboundThread, "Fails on a thread without a test_scope") {
+  const bool fail = failures_enabled();
+  std::thread t([fail] { EXPECT_FALSE(fail); });
+  t.join();
+}
+
+TEST_CASE("Runner-Failures", Crash, "Aborts, run it with --shards to keep running the other tests") {
+  if (failures_enabled()) {
+    std::abort();
+  }
+}
+
+TEST_CASE("Runner-Failures", Timeout, "Runs past its timeout", NANO_TEST_TIMEOUT(1)) {
+  if (failures_enabled()) {
+    std::this_thread::sleep_for(std::chrono::seconds(3));
+  }
+}
+} // namespace.
+
+NANO_TEST_MAIN()
@@ -27,6 +27,9 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <fstream>
@@ -37,6 +40,7 @@
 #include <locale>
 #include <map>
 #include <numeric>
+#include <queue>
 #include <set>
 #include <sstream>
 #include <stdexcept>
@@ -85,6 +89,20 @@
 
 #define NANO_TEST_CLANG_POP_WARNING() NANO_TEST_CLANG_DIAGNOSTIC_POP()
 
+#if defined(__GNUC__) || defined(__clang__)
+  #define NANO_TEST_LIKELY(X) __builtin_expect(!!(X), 1)
+  #define NANO_TEST_NOINLINE __attribute__((noinline))
+  #define NANO_TEST_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+  #define NANO_TEST_LIKELY(X) (!!(X))
+  #define NANO_TEST_NOINLINE __declspec(noinline)
+  #define NANO_TEST_COLD __declspec(noinline)
+#else
+  #define NANO_TEST_LIKELY(X) (!!(X))
+  #define NANO_TEST_NOINLINE
+  #define NANO_TEST_COLD
+#endif
+
 #define NANO_TEST_CONCAT1(_X, _Y) _X##_Y
 #define NANO_TEST_CONCAT(_X, _Y) NANO_TEST_CONCAT1(_X, _Y)
 
@@ -107,6 +125,16 @@ NANO_TEST_CLANG_DIAGNOSTIC(ignored, "-Wc++98-compat-pedantic")
 #define NANO_TEST_CASE_3(Group, Name, Desc) NANO_TEST_CASE_IMPL(Group, Name, Desc, "", 0)
 #define NANO_TEST_CASE_4(Group, Name, Desc, flags) NANO_TEST_CASE_IMPL(Group, Name, Desc, "", flags)
 
+/// Registers a benchmark, its body is called repeatedly and timed.
+/// Benchmarks run with the tests and report min, median, p99, MAD and iterations per second.
+#define BENCHMARK_CASE(...)                                                                                            \
+  NANO_TEST_EXPAND(NANO_TEST_GET_NTH_ARG(__VA_ARGS__, NANO_TEST_BENCHMARK_CASE_4, NANO_TEST_BENCHMARK_CASE_3,          \
+      NANO_TEST_BENCHMARK_CASE_2, NANO_TEST_BENCHMARK_CASE_1)(__VA_ARGS__))
+
+#define NANO_TEST_BENCHMARK_CASE_2(Group, Name) NANO_TEST_BENCHMARK_CASE_IMPL(Group, Name, "", 0)
+#define NANO_TEST_BENCHMARK_CASE_3(Group, Name, Desc) NANO_TEST_BENCHMARK_CASE_IMPL(Group, Name, Desc, 0)
+#define NANO_TEST_BENCHMARK_CASE_4(Group, Name, Desc, flags) NANO_TEST_BENCHMARK_CASE_IMPL(Group, Name, Desc, flags)
+
 NANO_TEST_CLANG_DIAGNOSTIC_POP()
 
 ///
@@ -119,6 +147,14 @@ NANO_TEST_CLANG_DIAGNOSTIC_POP()
 ///
 #define NANO_TEST_ABORT_ON_ERROR 1
 
+/// Set on the test items registered by BENCHMARK_CASE.
+#define NANO_TEST_BENCHMARK 2
+
+/// Fails the test when it runs longer than the given number of seconds, overrides --timeout.
+/// Combines with the other flags, e.g. NANO_TEST_ABORT_ON_ERROR | NANO_TEST_TIMEOUT(5).
+#define NANO_TEST_TIMEOUT(Seconds) (static_cast<long>(Seconds) << NANO_TEST_TIMEOUT_SHIFT)
+#define NANO_TEST_TIMEOUT_SHIFT 8
+
 ///
 #define NANO_TEST_ABORT() NANO_TEST_ABORT_IMPL()
 
@@ -242,6 +278,56 @@ NANO_TEST_CLANG_DIAGNOSTIC_POP()
 #define ASSERT_RANGE_GE(A, B, Size)                                                                                    \
   NANO_TEST_ASSERT_RANGE_IMPL(NANO_TEST_STRINGIFY(A >= B), A, B, Size, NANO_NAMESPACE::test::comp_ge)
 
+/// Tests that A[i] and B[i] are approximately equal for every i < Size, with the tolerance of EXPECT_FLOAT_EQ_T.
+/// A failure reports the number of mismatches, the worst element and the maximum errors.
+#define EXPECT_RANGE_FLOAT_EQ(A, B, Size, T)                                                                           \
+  NANO_TEST_EXPECT_RANGE_ERROR_IMPL(NANO_TEST_STRINGIFY(A == B), A, B, Size, T, 0, false)
+#define ASSERT_RANGE_FLOAT_EQ(A, B, Size, T)                                                                           \
+  NANO_TEST_ASSERT_RANGE_ERROR_IMPL(NANO_TEST_STRINGIFY(A == B), A, B, Size, T, 0, false)
+
+/// Tests that A[i] and B[i] are at most MaxUlps representable values apart for every i < Size.
+#define EXPECT_RANGE_ULP_EQ(A, B, Size, MaxUlps)                                                                       \
+  NANO_TEST_EXPECT_RANGE_ERROR_IMPL(NANO_TEST_STRINGIFY(A == B), A, B, Size, 0, MaxUlps, true)
+#define ASSERT_RANGE_ULP_EQ(A, B, Size, MaxUlps)                                                                       \
+  NANO_TEST_ASSERT_RANGE_ERROR_IMPL(NANO_TEST_STRINGIFY(A == B), A, B, Size, 0, MaxUlps, true)
+
+/// Tests that the Size elements of A are equal to the elements stored in the file at Path.
+/// The file is memory mapped, run with --update-golden to write A to it instead.
+#define EXPECT_RANGE_EQ_FILE(A, Size, Path)                                                                            \
+  NANO_TEST_EXPECT_GOLDEN_IMPL(NANO_TEST_STRINGIFY(A == Path), check_range_file<NANO_NAMESPACE::test::comp_eq>, A,     \
+      static_cast<std::size_t>(Size), Path)
+#define ASSERT_RANGE_EQ_FILE(A, Size, Path)                                                                            \
+  NANO_TEST_ASSERT_GOLDEN_IMPL(NANO_TEST_STRINGIFY(A == Path), assert_range_file<NANO_NAMESPACE::test::comp_eq>, A,    \
+      static_cast<std::size_t>(Size), Path)
+
+/// Tests that the bytes of Buffer (a std::string, std::vector or std::array) are identical to the file at Path.
+#define EXPECT_MATCHES_GOLDEN(Buffer, Path)                                                                            \
+  NANO_TEST_EXPECT_GOLDEN_IMPL(NANO_TEST_STRINGIFY(Buffer == Path), check_golden, Buffer, Path)
+#define ASSERT_MATCHES_GOLDEN(Buffer, Path)                                                                            \
+  NANO_TEST_ASSERT_GOLDEN_IMPL(NANO_TEST_STRINGIFY(Buffer == Path), assert_golden, Buffer, Path)
+
+/// Tests that the median time of Expr is at most Budget.
+/// Budget is a std::chrono duration (e.g. 200ns with std::chrono_literals) or a number of nanoseconds.
+/// Expr is timed over calibrated repetitions, like a BENCHMARK_CASE body.
+#define EXPECT_WITHIN_BUDGET(Expr, Budget)                                                                             \
+  NANO_TEST_PERFORMANCE_IMPL(                                                                                          \
+      #Expr " within " #Budget, NANO_TEST_TIMED_FCT(Expr), NANO_NAMESPACE::test::detail::to_ns(Budget), 1.0, false)
+#define ASSERT_WITHIN_BUDGET(Expr, Budget)                                                                             \
+  NANO_TEST_PERFORMANCE_IMPL(                                                                                          \
+      #Expr " within " #Budget, NANO_TEST_TIMED_FCT(Expr), NANO_NAMESPACE::test::detail::to_ns(Budget), 1.0, true)
+
+/// Tests that the median time of A is at most the median time of B.
+#define EXPECT_FASTER_THAN(A, B) EXPECT_FASTER_THAN_T(A, B, 1.0)
+#define ASSERT_FASTER_THAN(A, B) ASSERT_FASTER_THAN_T(A, B, 1.0)
+
+/// Tests that the median time of A is at most Ratio times the median time of B.
+#define EXPECT_FASTER_THAN_T(A, B, Ratio)                                                                              \
+  NANO_TEST_PERFORMANCE_IMPL(#A " faster than " #B, NANO_TEST_TIMED_FCT(A),                                            \
+      NANO_NAMESPACE::test::detail::measure_median_ns(NANO_TEST_TIMED_FCT(B)), Ratio, false)
+#define ASSERT_FASTER_THAN_T(A, B, Ratio)                                                                              \
+  NANO_TEST_PERFORMANCE_IMPL(#A " faster than " #B, NANO_TEST_TIMED_FCT(A),                                            \
+      NANO_NAMESPACE::test::detail::measure_median_ns(NANO_TEST_TIMED_FCT(B)), Ratio, true)
+
 // MARK: - Macro implementations -
 
 // C4514: unreferenced inline function has been removed.
@@ -269,6 +355,66 @@ NANO_TEST_MSVC_PUSH_WARNING(4514 5045)
   #error Unsupported cpp version
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+  #include <unistd.h>
+  #include <cerrno>
+
+  #define NANO_TEST_HAS_POSIX
+#endif
+
+#if defined(__linux__)
+  #include <link.h>
+#endif
+
+// Define NANO_TEST_NO_TSC to always time with the steady clock.
+#if !defined(NANO_TEST_NO_TSC) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+    #include <x86intrin.h>
+  #endif
+
+  #define NANO_TEST_HAS_TSC
+#endif
+
+// Define NANO_TEST_NO_SIMD to compare ranges with scalar loops only.
+#ifndef NANO_TEST_NO_SIMD
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #ifdef _MSC_VER
+      #include <intrin.h>
+    #endif
+    #define NANO_TEST_HAS_SSE2
+
+    #ifdef __AVX2__
+      #include <immintrin.h>
+      #define NANO_TEST_HAS_AVX2
+      #define NANO_TEST_AVX2_TARGET
+    #elif defined(__GNUC__) || defined(__clang__)
+      #include <immintrin.h>
+      #define NANO_TEST_HAS_AVX2_DISPATCH
+      #define NANO_TEST_AVX2_TARGET __attribute__((target("avx2")))
+    #endif
+  #elif defined(__aarch64__) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define NANO_TEST_HAS_NEON
+  #endif
+#endif
+
+// Define NANO_TEST_SECTION_REGISTRATION to emit every test as a constant record in a linker section
+// rather than registering it from a constructor. ELF only, the constructors are used elsewhere.
+#if defined(NANO_TEST_SECTION_REGISTRATION) && defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+  #define NANO_TEST_HAS_SECTION_REGISTRATION
+#endif
+
 #ifdef NANO_TEST_CPP_98
   #include <ctime>
   #include <sstream>
@@ -299,9 +445,22 @@ NANO_TEST_CLANG_DIAGNOSTIC(ignored, "-Wsuggest-destructor-override")
 NANO_TEST_CLANG_DIAGNOSTIC(ignored, "-Wsuggest-override")
 
 #else
+  #include <atomic>
   #include <chrono>
+  #include <condition_variable>
+  #include <deque>
+  #include <memory>
+  #include <mutex>
+  #include <new>
+  #include <thread>
   #include <type_traits>
 
+  #define NANO_TEST_HAS_THREADS
+
+  #ifdef NANO_TEST_HAS_POSIX
+    #define NANO_TEST_HAS_FORK
+  #endif
+
   #define NANO_TEST_INLINE_CONSTEXPR NANO_TEST_INLINE_PREFIX constexpr
   #define NANO_TEST_INLINE_VARIABLE NANO_TEST_INLINE_PREFIX
   #define NANO_TEST_NULLPTR nullptr
@@ -529,15 +688,26 @@ public:
       count = _arguments.size();
     }
 
-    for (size_t i = page * count; i < std::min<size_t>(page * count + count, _arguments.size()); i++) {
-      argument& a = _arguments[i];
+    const size_t end = std::min<size_t>(page * count + count, _arguments.size());
+    std::vector<std::string> names;
+    size_t width = 22;
+
+    for (size_t i = page * count; i < end; i++) {
+      const argument& a = _arguments[i];
       std::string name = a._names[0];
 
       for (size_t n = 1; n < a._names.size(); ++n) {
         name.append(", " + a._names[n]);
       }
 
-      std::cout << "    " << std::setw(23) << std::left << name << std::setw(23) << a._desc;
+      width = std::max(width, name.size());
+      names.push_back(name);
+    }
+
+    for (size_t i = page * count; i < end; i++) {
+      const argument& a = _arguments[i];
+      std::cout << "    " << std::setw(static_cast<int>(width + 1)) << std::left << names[i - page * count]
+                << std::setw(23) << a._desc;
       if (a._required) {
         std::cout << " (Required)";
       }
@@ -712,7 +882,8 @@ private:
 
     size_t name_end;
     for (name_end = 0; name_end < arg.length(); ++name_end) {
-      if (std::ispunct(static_cast<int>(arg[name_end]))) {
+      // Dashes and underscores are part of long names (--asd-f, --asd_f).
+      if (std::ispunct(static_cast<int>(arg[name_end])) && arg[name_end] != '-' && arg[name_end] != '_') {
         break;
       }
     }
@@ -860,67 +1031,231 @@ inline std::ostream& operator<<(std::ostream& os, const result& r) {
 namespace NANO_NAMESPACE {
 namespace test {
 
+  // MARK: - Message formatting -
+
+  namespace detail {
+    /// Part of a formatted message, kept as a position so that it survives copying the message.
+    struct message_slice {
+      std::size_t offset;
+      std::size_t size;
+    };
+
+    /// Formats a failure message in a fixed buffer, without allocating and independently of the stream locale.
+    ///
+    /// Bound to a stream, the buffer is written to it whenever it is full and by flush. Otherwise the
+    /// text past the capacity is dropped. The buffer is always null terminated.
+    template <std::size_t Capacity>
+    class message_buffer {
+    public:
+      inline message_buffer()
+          : m_os(NANO_TEST_NULLPTR)
+          , m_size(0) {
+        m_data[0] = 0;
+      }
+
+      inline explicit message_buffer(std::ostream& os)
+          : m_os(&os)
+          , m_size(0) {
+        m_data[0] = 0;
+      }
+
+      inline const char* c_str() const { return m_data; }
+      inline const char* data(const message_slice& s) const { return m_data + s.offset; }
+      inline std::size_t size() const { return m_size; }
+
+      inline message_buffer& append(const char* str, std::size_t size) {
+        while (size) {
+          const std::size_t count = std::min(size, Capacity - 1 - m_size);
+          if (count == 0) {
+            if (!m_os) {
+              break;
+            }
+            flush();
+            continue;
+          }
+
+          std::memcpy(m_data + m_size, str, count);
+          m_size += count;
+          str += count;
+          size -= count;
+        }
+
+        m_data[m_size] = 0;
+        return *this;
+      }
+
+      /// Appends at most max_size characters of str and returns where they are.
+      inline message_slice append_slice(const char* str, std::size_t max_size) {
+        message_slice s;
+        s.offset = m_size;
+        append(str, std::min(std::strlen(str), max_size));
+        s.size = m_size - s.offset;
+        return s;
+      }
+
+      inline message_buffer& operator<<(const char* str) { return append(str, std::strlen(str)); }
+      inline message_buffer& operator<<(char c) { return append(&c, 1); }
+      inline message_buffer& operator<<(int v) { return append_integer(v < 0, magnitude(v)); }
+      inline message_buffer& operator<<(long v) { return append_integer(v < 0, magnitude(v)); }
+      inline message_buffer& operator<<(long long v) { return append_integer(v < 0, magnitude(v)); }
+      inline message_buffer& operator<<(unsigned int v) { return append_integer(false, v); }
+      inline message_buffer& operator<<(unsigned long v) { return append_integer(false, v); }
+      inline message_buffer& operator<<(unsigned long long v) { return append_integer(false, v); }
+
+      /// Appends v with a fixed number of decimals, like std::fixed up to the rounding of the last digit.
+      inline message_buffer& append_fixed(double v, unsigned int decimals) {
+        if (v != v) {
+          return append("nan", 3);
+        }
+
+        const bool negative = v < 0;
+        const double a = negative ? -v : v;
+
+        unsigned long long scale = 1;
+        for (unsigned int i = 0; i < decimals; i++) {
+          scale *= 10;
+        }
+
+        // Out of the range of the integer formatting, rare enough for a snprintf.
+        const double scaled = a * static_cast<double>(scale) + 0.5;
+        if (!(scaled < 1.8e19)) {
+          char text[512];
+          const int size = std::snprintf(text, sizeof(text), "%.*f", static_cast<int>(decimals), v);
+          return append(text, size > 0 ? std::min(static_cast<std::size_t>(size), sizeof(text) - 1) : 0);
+        }
+
+        const unsigned long long n = static_cast<unsigned long long>(scaled);
+        append_integer(negative, n / scale);
+
+        if (decimals) {
+          char digits[20];
+          unsigned long long fraction = n % scale;
+          for (unsigned int i = decimals; i > 0; i--) {
+            digits[i - 1] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+          }
+          append(".", 1);
+          append(digits, decimals);
+        }
+        return *this;
+      }
+
+      /// Writes the buffer to the bound stream and empties it.
+      inline void flush() {
+        if (m_os && m_size) {
+          m_os->write(m_data, static_cast<std::streamsize>(m_size));
+        }
+        m_size = 0;
+        m_data[0] = 0;
+      }
+
+    private:
+      std::ostream* m_os;
+      std::size_t m_size;
+      char m_data[Capacity];
+
+      template <typename T>
+      inline static unsigned long long magnitude(T v) {
+        return v < 0 ? 0ull - static_cast<unsigned long long>(v) : static_cast<unsigned long long>(v);
+      }
+
+      inline message_buffer& append_integer(bool negative, unsigned long long v) {
+        char digits[24];
+        char* const end = digits + sizeof(digits);
+        char* p = end;
+        do {
+          *--p = static_cast<char>('0' + v % 10);
+          v /= 10;
+        } while (v);
+
+        if (negative) {
+          *--p = '-';
+        }
+        return append(p, static_cast<std::size_t>(end - p));
+      }
+    };
+  } // namespace detail
+
   // MARK: - Exceptions -
 
+  /// Failure of an ASSERT, thrown out of the test.
+  ///
+  /// The message is formatted in the exception itself when it is thrown, with its expression and
+  /// source file kept as slices of it. A failing ASSERT allocates nothing but the exception.
   template <class = void>
   class test_exception : public std::exception {
   public:
+    enum { message_capacity = 1024, expression_capacity = 640, file_capacity = 256 };
+
     virtual ~test_exception() NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+    inline virtual const char* what() const NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE { return m_message.c_str(); }
+
+    /// Expected expression, not null terminated.
+    inline const char* expression() const { return m_message.data(m_expression); }
+    inline std::size_t expression_size() const { return m_expression.size; }
+
+    /// Source file, not null terminated.
+    inline const char* file() const { return m_message.data(m_file); }
+    inline std::size_t file_size() const { return m_file.size; }
+
+    inline int line() const { return m_line; }
+
+  protected:
+    inline explicit test_exception(int line)
+        : m_line(line) {
+      m_expression.offset = m_expression.size = 0;
+      m_file.offset = m_file.size = 0;
+    }
+
+    detail::message_buffer<message_capacity> m_message;
+    detail::message_slice m_expression;
+    detail::message_slice m_file;
+    int m_line;
+
+    inline void write_source(const char* file) {
+      m_message << "\n      source   : ";
+      m_file = m_message.append_slice(file, file_capacity);
+      m_message << "\n      line     : " << m_line << "\n";
+    }
   };
 
   template <class = void>
   class failed_expect_exception : public test_exception<> {
   public:
     inline failed_expect_exception(const char* expr_str, const char* file, int line)
-        : m_error_str(create_message(expr_str, file, line)) {}
-
-    virtual ~failed_expect_exception() NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
-
-        virtual const char* what() const NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE {
-      return m_error_str.c_str();
+        : test_exception<>(line) {
+      m_message << "    - Assert failed\n      expected : ";
+      m_expression = m_message.append_slice(expr_str, expression_capacity);
+      write_source(file);
     }
 
-  private:
-    std::string m_error_str;
-
-    static inline std::string create_message(const char* expr_str, const char* file, int line) {
-      std::stringstream ss;
-      ss << "    - Assert failed\n      expected : " << expr_str << "\n      source   : " << file
-         << "\n      line     : " << line << "\n";
-      return ss.str();
-    }
+    virtual ~failed_expect_exception() NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
   };
 
   template <class = void>
   class failed_exception : public test_exception<> {
   public:
     inline failed_exception(const char* except_str, const char* expected_str, const char* file, int line)
-        : m_error_str(create_message(except_str, expected_str, file, line)) {}
-
-    virtual ~failed_exception() NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
-
-        inline virtual const char* what() const NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE {
-      return m_error_str.c_str();
+        : test_exception<>(line) {
+      m_message << "    - Assert exception failed\n      expected : ";
+      m_expression = m_message.append_slice(expected_str, expression_capacity);
+      m_message << "\n      got      : " << except_str;
+      write_source(file);
     }
 
-  private:
-    std::string m_error_str;
-
-    static inline std::string create_message(
-        const char* except_str, const char* expected_str, const char* file, int line) {
-      std::stringstream ss;
-      ss << "    - Assert exception failed\n      expected : " << expected_str << "\n      got      : " << except_str
-         << "\n      source   : " << file << "\n      line     : " << line << "\n";
-
-      return ss.str();
-    }
+    virtual ~failed_exception() NANO_TEST_NOEXCEPT NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
   };
 
+  NANO_TEST_NORETURN NANO_TEST_COLD inline void throw_failed_expect(const char* expr_str, const char* file, int line) {
+    throw NANO_NAMESPACE::test::failed_expect_exception<>(expr_str, file, line);
+  }
+
   inline void custom_assert(const char* expr_str, bool expr, const char* file, int line) {
-    if (expr) {
+    if (NANO_TEST_LIKELY(expr)) {
       return;
     }
-    throw NANO_NAMESPACE::test::failed_expect_exception<>(expr_str, file, line);
+    throw_failed_expect(expr_str, file, line);
   }
 
   NANO_TEST_NORETURN inline void custom_exception(const char* expr_str, bool is_caught, const char* file, int line) {
@@ -939,18 +1274,131 @@ namespace test {
 #endif // NANO_TEST_CPP_98
     };
 
+    inline unsigned long long now_ns() {
 #ifdef NANO_TEST_CPP_98
-    template <class StartT>
-    inline NANO_TEST_CONSTEXPR double get_us_count(const StartT& start) {
-      return (static_cast<double>(std::clock()) - static_cast<double>(start)) * (1000000.0 / CLOCKS_PER_SEC);
-    }
+      return static_cast<unsigned long long>(std::clock()) * (1000000000ULL / CLOCKS_PER_SEC);
 #else
-    template <class StartT>
-    inline NANO_TEST_CONSTEXPR std::chrono::microseconds::rep get_us_count(const StartT& start) {
-      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start)
-          .count();
+      return static_cast<unsigned long long>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+              .count());
+#endif
     }
+
+    /// Timestamps of the runner, in ticks of the selected source.
+    ///
+    /// The tsc source reads the time stamp counter, calibrated against the steady clock, and is only
+    /// available when the counter is invariant. Ticks are converted to ns when a duration is needed.
+    /// The calibration measures the ticks elapsed since set_source when a duration is converted, so the
+    /// runner does not busy wait for it at startup.
+    class clock {
+    public:
+      enum source_type { steady, tsc };
+
+      typedef unsigned long long tick_type;
+
+      static inline tick_type now() {
+#ifdef NANO_TEST_HAS_TSC
+        if (source() == tsc) {
+          return __rdtsc();
+        }
+#endif
+        return now_ns();
+      }
+
+      static inline double to_ns(tick_type ticks) {
+        if (source() == steady) {
+          return static_cast<double>(ticks);
+        }
+
+        const double ratio = calibration().ns_per_tick;
+        return static_cast<double>(ticks) * (ratio > 0 ? ratio : calibrate_tsc());
+      }
+
+      static inline double elapsed_ns(tick_type start) { return to_ns(now() - start); }
+
+      static inline source_type get_source() { return source(); }
+
+      /// Selects the source of the following timestamps, falls back to steady when tsc is not available.
+      /// Not thread safe, called by the runner before any test starts.
+      static inline source_type set_source(source_type s) {
+        if (s == tsc && !has_invariant_tsc()) {
+          s = steady;
+        }
+
+        if (s != source() && s == tsc) {
+          calibration().start_ns = now_ns();
+          calibration().start_ticks = now_tsc();
+          calibration().ns_per_tick = 0.0;
+        }
+
+        source() = s;
+        return s;
+      }
+
+      static inline bool has_invariant_tsc() {
+#if defined(NANO_TEST_HAS_TSC) && defined(_MSC_VER)
+        int regs[4] = { 0 };
+        __cpuid(regs, 0x80000000);
+        if (static_cast<unsigned int>(regs[0]) < 0x80000007u) {
+          return false;
+        }
+        __cpuid(regs, 0x80000007);
+        return (regs[3] & (1 << 8)) != 0;
+#elif defined(NANO_TEST_HAS_TSC)
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+      }
+
+    private:
+      static inline source_type& source() {
+        static source_type s = steady;
+        return s;
+      }
+
+      struct calibration_state {
+        unsigned long long start_ns;
+        tick_type start_ticks;
+
+        /// 0 until the first conversion. Workers calibrating at once store nearly identical ratios.
+#ifdef NANO_TEST_HAS_THREADS
+        std::atomic<double> ns_per_tick;
+#else
+        double ns_per_tick;
+#endif
+      };
+
+      static inline calibration_state& calibration() {
+        static calibration_state c;
+        return c;
+      }
+
+      static inline tick_type now_tsc() {
+#ifdef NANO_TEST_HAS_TSC
+        return __rdtsc();
+#else
+        return 0;
 #endif
+      }
+
+      /// Ns per tick since set_source, busy waiting on the steady clock until at least 1 ms has elapsed.
+      /// The ratio is kept once 10 ms have elapsed, earlier conversions use the shorter window.
+      static inline double calibrate_tsc() {
+        calibration_state& c = calibration();
+        unsigned long long ns = 0;
+        while ((ns = now_ns() - c.start_ns) < 1000000ULL) {
+        }
+
+        const tick_type ticks = now_tsc() - c.start_ticks;
+        const double ratio = ticks ? static_cast<double>(ns) / static_cast<double>(ticks) : 1.0;
+        if (ns >= 10000000ULL) {
+          c.ns_per_tick = ratio;
+        }
+        return ratio;
+      }
+    };
 
     NANO_TEST_INLINE_CONSTEXPR const char* kOk = "[       OK ]";
     NANO_TEST_INLINE_CONSTEXPR const char* kFailed = "[  FAILED  ]";
@@ -963,395 +1411,6016 @@ namespace test {
 
   typedef void (*test_function)();
 
+  /// Registered test, the strings are the literals of the TEST_CASE macro.
   struct test_item {
-    inline test_item(const std::string& _name, const std::string& _desc, test_function _fct, long _flags)
-        : name(_name)
-        , desc(_desc)
-        , fct(_fct)
-        , flags(_flags) {}
-
-    std::string name;
-    std::string desc;
+    const char* name;
+    const char* desc;
     test_function fct;
     long flags;
+
+    /// Location of the TEST_CASE macro.
+    const char* file;
+    std::size_t line;
   };
 
-  // MARK: - Test check result -
+  /// Tests of a group, a slice of the indexed test registry sorted by name.
+  struct test_group {
+    inline const test_item* begin() const { return items; }
+    inline const test_item* end() const { return items + size; }
 
-  struct check_result {
-    inline check_result(const char* _group, const test_item* _item, const char* _expr, const char* _file,
-        std::size_t _line, std::size_t _end_time, bool _success)
-        : group(_group)
-        , item(_item)
-        , expr(_expr)
-        , file(_file)
-        , line(_line)
-        , end_time(_end_time)
-        , success(_success) {}
+    std::string name;
+    const test_item* items;
+    std::size_t size;
+  };
 
+  /// Test and the name of its group, as registered.
+  struct test_record {
     const char* group;
-    const test_item* item;
-    const char* expr;
-
-    const char* file;
-    std::size_t line;
-    std::size_t end_time;
-    bool success;
-    char reserved[7];
+    test_item item;
   };
 
-  template <typename Comp, typename T1, typename T2>
-  inline bool compare_range(const T1* a, const T2* b, std::size_t size) {
-    for (std::size_t i = 0; i < size; i++) {
-      if (!Comp()(a[i], b[i])) {
-        return false;
-      }
-    }
-
-    return true;
-  }
+#ifdef NANO_TEST_HAS_SECTION_REGISTRATION
+  namespace detail {
+    // Bounds of the section filled by NANO_TEST_REGISTER_IMPL, defined by the linker.
+    extern "C" const test_record __start_nano_test_records[] __attribute__((weak, visibility("hidden")));
+    extern "C" const test_record __stop_nano_test_records[] __attribute__((weak, visibility("hidden")));
+  } // namespace detail
+#endif
 
-  // MARK: - Tests manager -
+  // MARK: - Benchmarks -
 
-  class manager {
-  public:
-    typedef std::vector<test_item> test_vector;
-    typedef std::map<std::string, test_vector> test_map;
+  struct benchmark_options {
+    inline benchmark_options()
+        : samples(50)
+        , min_sample_ns(1000000.0) {}
 
-    struct state {
-      state()
-          : current_item(NANO_TEST_NULLPTR)
-          , passed_count(0)
-          , failed_count(0)
-          , total_tests(0)
-          , check_count(0)
-          , failed_check_count(0)
-          , results(NANO_TEST_NULLPTR)
-          , current_test_failed(false)
-          , should_stop(false)
+    /// Number of timed samples.
+    std::size_t samples;
 
-      {}
+    /// Minimum duration of a sample, the iteration count is calibrated to reach it.
+    double min_sample_ns;
+  };
 
-      const test_item* current_item;
-      std::size_t passed_count;
-      std::size_t failed_count;
-      std::size_t total_tests;
-      std::size_t check_count;
-      std::size_t failed_check_count;
+  struct benchmark_result {
+    inline benchmark_result()
+        : group(NANO_TEST_NULLPTR)
+        , item(NANO_TEST_NULLPTR)
+        , iterations(0)
+        , min_ns(0)
+        , median_ns(0)
+        , p99_ns(0)
+        , mad_ns(0)
+        , iterations_per_second(0) {}
 
-#ifdef NANO_TEST_CPP_98
-      struct clock {
-        static inline double now() { return static_cast<double>(std::clock()); }
-      };
-      double launch_start_time;
-      double group_start_time;
-      double test_start_time;
-#else
-      typedef std::chrono::high_resolution_clock clock;
+    const char* group;
+    const test_item* item;
 
-      clock::time_point launch_start_time;
-      clock::time_point group_start_time;
-      clock::time_point test_start_time;
-#endif
-      const char* current_group;
-      const char* current_test;
+    /// Iterations per sample.
+    std::size_t iterations;
 
-      std::vector<check_result>* results;
+    /// Time per iteration of every sample, sorted.
+    std::vector<double> samples_ns;
 
-      bool current_test_failed;
-      bool should_stop;
-      char reserved[6];
+    double min_ns;
+    double median_ns;
+    double p99_ns;
 
-      inline void add_check(bool success, const char* expr, const char* file, std::size_t line) {
-        if (results) {
-          results->push_back(check_result(current_group, current_item, expr, file, line,
-              static_cast<std::size_t>(detail::get_us_count(test_start_time)), success));
-        }
-      }
+    /// Median absolute deviation.
+    double mad_ns;
+    double iterations_per_second;
+  };
 
-      inline void start_group(const test_map::value_type& g) {
-        current_group = g.first.c_str();
+  /// Prevents the compiler from optimizing away the computation of value.
+  template <typename T>
+  inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+  }
 
-        group_start_time = state::clock::now();
-        std::cout << "[----------] " << g.second.size() << " " << test(g.second.size()) << " from group '" << g.first
-                  << "'" << std::endl;
+  namespace detail {
+    template <typename Fct>
+    inline double time_iterations(Fct& fct, std::size_t iterations) {
+      const clock::tick_type start = clock::now();
+      for (std::size_t i = 0; i < iterations; i++) {
+        fct();
       }
+      return clock::elapsed_ns(start);
+    }
 
-      inline void end_group(const test_map::value_type& g) {
-        std::cout << "[----------] group '" << g.first << "' (" << group_us() << " us). \n\n";
+    /// Linear interpolation between the closest ranks of a sorted vector.
+    inline double percentile(const std::vector<double>& sorted, double p) {
+      if (sorted.empty()) {
+        return 0;
       }
 
-      inline void run_test(const test_item& t) {
-        current_item = &t;
-        current_test = t.name.c_str();
-        current_test_failed = false;
-        check_count = 0;
-        failed_check_count = 0;
-        test_start_time = state::clock::now();
+      const double rank = p * static_cast<double>(sorted.size() - 1);
+      const std::size_t lo = static_cast<std::size_t>(rank);
+      const std::size_t hi = std::min(lo + 1, sorted.size() - 1);
+      return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - static_cast<double>(lo));
+    }
 
-        std::cout << "[ RUN      ] > test case " << t.name << " : " << t.desc << std::endl;
+    inline void compute_statistics(benchmark_result& r) {
+      std::vector<double>& s = r.samples_ns;
+      std::sort(s.begin(), s.end());
 
-        try {
-          t.fct();
-        } catch (const NANO_NAMESPACE::test::test_exception<>& e) {
-          failed_check_count++;
-          current_test_failed = true;
-          std::cout << e.what();
-        } catch (const std::exception& e) {
-          // Other errors
-          throw e;
-        }
+      r.min_ns = s.empty() ? 0 : s.front();
+      r.median_ns = percentile(s, 0.5);
+      r.p99_ns = percentile(s, 0.99);
+      r.iterations_per_second = r.median_ns > 0 ? 1000000000.0 / r.median_ns : 0;
 
-        if (current_test_failed) {
-          failed_count++;
-        }
-        else {
-          passed_count++;
-        }
+      std::vector<double> deviations(s.size());
+      for (std::size_t i = 0; i < s.size(); i++) {
+        deviations[i] = std::abs(s[i] - r.median_ns);
+      }
 
-        report(!current_test_failed);
+      std::sort(deviations.begin(), deviations.end());
+      r.mad_ns = percentile(deviations, 0.5);
+    }
 
-        if (current_test_failed) {
-          if (t.flags & NANO_TEST_ABORT_ON_ERROR) {
-            should_stop = true;
-          }
+    /// Calls fct repeatedly and returns the statistics of the time per call.
+    ///
+    /// The number of iterations per sample grows until a sample lasts at least
+    /// options.min_sample_ns, then options.samples samples are taken.
+    template <typename Fct>
+    inline benchmark_result measure(Fct fct, const benchmark_options& options) {
+      const std::size_t max_iterations = static_cast<std::size_t>(1) << 30;
+
+      // Warm up.
+      fct();
+
+      std::size_t n = 1;
+      for (;;) {
+        const double ns = time_iterations(fct, n);
+        if (ns >= options.min_sample_ns || n >= max_iterations) {
+          break;
         }
+
+        const double factor = ns > 0 ? 1.2 * options.min_sample_ns / ns : 10.0;
+        n = static_cast<std::size_t>(static_cast<double>(n) * std::min(std::max(factor, 2.0), 10.0));
       }
 
-      inline void report(bool passed) {
-        if (passed) {
-          std::cout << detail::kOk << " < test case " << current_test << " (" << check_count << " checks) ("
-                    << test_us() << " us)" << std::endl;
-        }
-        else {
-          std::cout << detail::kFailed << " < test case " << current_test << " (" << (check_count - failed_check_count)
-                    << '/' << check_count << " checks) (" << test_us() << " us)" << std::endl;
-        }
+      benchmark_result r;
+      r.iterations = n;
+      r.samples_ns.reserve(options.samples);
+
+      for (std::size_t i = 0; i < options.samples; i++) {
+        r.samples_ns.push_back(time_iterations(fct, n) / static_cast<double>(n));
       }
 
-#ifdef NANO_TEST_CPP_98
-      inline double test_us() const { return detail::get_us_count(test_start_time); }
-      inline double group_us() const { return detail::get_us_count(group_start_time); }
-      inline double launch_us() const { return detail::get_us_count(launch_start_time); }
-#else
-      inline std::chrono::microseconds::rep test_us() const { return detail::get_us_count(test_start_time); }
+      compute_statistics(r);
+      return r;
+    }
+
+#ifndef NANO_TEST_CPP_98
+    /// Right hand side of a comma expression that keeps the value of the left hand side alive.
+    /// When the left hand side is void the built-in comma operator is used instead.
+    struct result_sink {
+      template <typename T>
+      inline friend void operator,(T&& value, result_sink) {
+        do_not_optimize(value);
+      }
+    };
 
-      inline std::chrono::microseconds::rep group_us() const { return detail::get_us_count(group_start_time); }
+    template <typename Rep, typename Period>
+    inline double to_ns(const std::chrono::duration<Rep, Period>& d) {
+      return std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(d).count();
+    }
 
-      inline std::chrono::microseconds::rep launch_us() const { return detail::get_us_count(launch_start_time); }
+    inline double to_ns(double ns) { return ns; }
 #endif
 
-      inline static NANO_TEST_CONSTEXPR const char* test(std::size_t count) {
-        return count <= 1 ? detail::kTest : detail::kTests;
+    /// Prints a duration with a unit that keeps it readable.
+    inline void print_ns(std::ostream& os, double ns) {
+      static const char* units[] = { "ns", "us", "ms", "s" };
+      std::size_t u = 0;
+      while (ns >= 1000.0 && u < 3) {
+        ns /= 1000.0;
+        u++;
       }
 
-      inline static NANO_TEST_CONSTEXPR const char* group(std::size_t count) { return count <= 1 ? "group" : "groups"; }
+      // Every test prints its duration, formatted without the stream flags and locale.
+      message_buffer<64> text(os);
+      text.append_fixed(ns, 2) << ' ' << units[u];
+      text.flush();
+    }
+
+    inline void print_rate(std::ostream& os, double rate) {
+      static const char* units[] = { "", "K", "M", "G" };
+      std::size_t u = 0;
+      while (rate >= 1000.0 && u < 3) {
+        rate /= 1000.0;
+        u++;
+      }
+
+      const std::ios_base::fmtflags flags = os.flags();
+      const std::streamsize precision = os.precision();
+      os << std::fixed << std::setprecision(2) << rate << units[u];
+      os.flags(flags);
+      os.precision(precision);
+    }
+  } // namespace detail
+
+  // MARK: - Baseline -
+
+  /// Timing samples of a test or a benchmark, collected when a baseline file is used.
+  struct timing_record {
+    inline timing_record()
+        : group(NANO_TEST_NULLPTR)
+        , item(NANO_TEST_NULLPTR)
+        , benchmark(false) {}
+
+    const char* group;
+    const test_item* item;
+
+    /// True for the samples of a BENCHMARK_CASE, false for the duration of a test.
+    bool benchmark;
+
+    std::vector<double> samples_ns;
+  };
+
+  namespace detail {
+    /// Unique temporary name next to path, so concurrent writers (-j workers, shards) never share one.
+    inline std::string temporary_path(const char* path) {
+#ifdef NANO_TEST_HAS_THREADS
+      static std::atomic<unsigned long> counter(0);
+#else
+      static unsigned long counter = 0;
+#endif
+#ifdef NANO_TEST_HAS_POSIX
+      const unsigned long pid = static_cast<unsigned long>(::getpid());
+#else
+      const unsigned long pid = 0;
+#endif
+      std::ostringstream os;
+      os << path << '.' << pid << '.' << counter++ << ".tmp";
+      return os.str();
+    }
+
+    /// Writes to a temporary file renamed over path, readers never see a partially written file.
+    /// The data is synced to disk before the rename, so a crash leaves either the old or the new content.
+    inline bool write_file_atomic(const char* path, const void* data, std::size_t size) {
+      const std::string tmp = temporary_path(path);
+#ifdef NANO_TEST_HAS_POSIX
+      const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_TRUNC, 0666);
+      if (fd < 0) {
+        return false;
+      }
+
+      const char* bytes = static_cast<const char*>(data);
+      bool written = true;
+      while (size) {
+        const ssize_t count = ::write(fd, bytes, size);
+        if (count < 0 && errno == EINTR) {
+          continue;
+        }
+
+        if (count <= 0) {
+          written = false;
+          break;
+        }
+
+        bytes += count;
+        size -= static_cast<std::size_t>(count);
+      }
+
+      written = ::fsync(fd) == 0 && written;
+      written = ::close(fd) == 0 && written;
+#else
+      bool written;
+      {
+        std::ofstream file(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        written = static_cast<bool>(file.flush());
+      }
+#endif
+
+      if (!written || std::rename(tmp.c_str(), path) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+      }
+
+      return true;
+    }
+
+    /// Timing distributions of previous runs, read and written by --baseline-file.
+    ///
+    /// The file is stored in native byte order:
+    ///   char[4] magic "NTBL", uint32 version, uint32 entry count, then for every entry
+    ///   uint8 kind (0 test, 1 benchmark), uint16 key size, key ("group.test"),
+    ///   uint32 sample count and the samples as float64 ns.
+    class baseline {
+    public:
+      enum { version = 1, max_test_history = 32 };
+
+      struct entry {
+        inline entry()
+            : benchmark(false) {}
+
+        bool benchmark;
+        std::vector<double> samples_ns;
+      };
+
+      typedef std::map<std::string, entry> entry_map;
+
+      entry_map entries;
+
+      static inline std::string key(const timing_record& r) { return key(r.group, r.item->name); }
+      static inline std::string key(const char* group, const char* name) { return std::string(group) + "." + name; }
+
+      /// Returns false when the file is missing or is not a baseline of this version.
+      inline bool load(const std::string& path) {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        char magic[4];
+        unsigned int v = 0;
+        unsigned int count = 0;
+
+        if (!read(file, magic, sizeof(magic)) || std::memcmp(magic, "NTBL", 4) != 0 || !read(file, &v, sizeof(v))
+            || v != version || !read(file, &count, sizeof(count))) {
+          return false;
+        }
+
+        entry_map loaded;
+        for (unsigned int i = 0; i < count; i++) {
+          unsigned char kind = 0;
+          unsigned short key_size = 0;
+          unsigned int sample_count = 0;
+
+          if (!read(file, &kind, sizeof(kind)) || !read(file, &key_size, sizeof(key_size))) {
+            return false;
+          }
+
+          std::string k(key_size, '\0');
+          if ((key_size && !read(file, &k[0], key_size)) || !read(file, &sample_count, sizeof(sample_count))) {
+            return false;
+          }
+
+          entry& e = loaded[k];
+          e.benchmark = kind != 0;
+          e.samples_ns.resize(sample_count);
+          if (sample_count && !read(file, &e.samples_ns[0], sample_count * sizeof(double))) {
+            return false;
+          }
+        }
+
+        entries.swap(loaded);
+        return true;
+      }
+
+      /// Written with write_file_atomic, an interrupted run never leaves a truncated baseline.
+      inline bool save(const std::string& path) const {
+        std::string data("NTBL", 4);
+        const unsigned int v = version;
+        const unsigned int count = static_cast<unsigned int>(entries.size());
+        append(data, &v, sizeof(v));
+        append(data, &count, sizeof(count));
+
+        for (entry_map::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+          const unsigned char kind = it->second.benchmark ? 1 : 0;
+          const unsigned short key_size = static_cast<unsigned short>(std::min<std::size_t>(it->first.size(), 0xFFFF));
+          const unsigned int sample_count = static_cast<unsigned int>(it->second.samples_ns.size());
+          append(data, &kind, sizeof(kind));
+          append(data, &key_size, sizeof(key_size));
+          append(data, it->first.data(), key_size);
+          append(data, &sample_count, sizeof(sample_count));
+          if (sample_count) {
+            append(data, &it->second.samples_ns[0], sample_count * sizeof(double));
+          }
+        }
+
+        return write_file_atomic(path.c_str(), data.data(), data.size());
+      }
+
+      /// Adds the samples of the current run.
+      /// Test durations are appended to the history of the test, benchmark samples replace the previous ones.
+      inline void update(const timing_record& r) {
+        entry& e = entries[key(r)];
+        if (r.benchmark || e.benchmark) {
+          e.samples_ns.clear();
+        }
+
+        e.benchmark = r.benchmark;
+        e.samples_ns.insert(e.samples_ns.end(), r.samples_ns.begin(), r.samples_ns.end());
+
+        if (!r.benchmark && e.samples_ns.size() > max_test_history) {
+          e.samples_ns.erase(e.samples_ns.begin(), e.samples_ns.end() - max_test_history);
+        }
+      }
+
+    private:
+      static inline bool read(std::ifstream& file, void* data, std::size_t size) {
+        return static_cast<bool>(file.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+      }
+
+      static inline void append(std::string& data, const void* bytes, std::size_t size) {
+        data.append(static_cast<const char*>(bytes), size);
+      }
+    };
+
+    struct weight_greater {
+      inline weight_greater(const std::vector<double>& w)
+          : weights(w) {}
+
+      inline bool operator()(std::size_t a, std::size_t b) const { return weights[a] > weights[b]; }
+
+      const std::vector<double>& weights;
+    };
+
+    inline double median(std::vector<double> samples) {
+      std::sort(samples.begin(), samples.end());
+      return percentile(samples, 0.5);
+    }
+
+    /// Longest processing time first bin packing of the weights into shard_count shards.
+    /// Ties are broken by index, so every machine computes the same plan from the same weights.
+    inline void plan_shards(
+        const std::vector<double>& weights, std::size_t shard_count, std::vector<std::size_t>& assignment) {
+      std::vector<std::size_t> order(weights.size());
+      for (std::size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+      }
+
+      std::stable_sort(order.begin(), order.end(), weight_greater(weights));
+
+      typedef std::pair<double, std::size_t> load;
+      std::priority_queue<load, std::vector<load>, std::greater<load> > loads;
+      for (std::size_t i = 0; i < shard_count; i++) {
+        loads.push(load(0.0, i));
+      }
+
+      assignment.resize(weights.size());
+      for (std::size_t i = 0; i < order.size(); i++) {
+        load l = loads.top();
+        loads.pop();
+        assignment[order[i]] = l.second;
+        l.first += weights[order[i]];
+        loads.push(l);
+      }
+    }
+
+#ifdef NANO_TEST_CPP_98
+    /// Complementary error function, Abramowitz and Stegun 7.1.26 (absolute error below 1.5e-7).
+    inline double erfc(double x) {
+      const double z = std::fabs(x);
+      const double t = 1.0 / (1.0 + 0.3275911 * z);
+      const double poly
+          = t * (0.254829592 + t * (-0.284496736 + t * (1.421413741 + t * (-1.453152027 + t * 1.061405429))));
+      const double r = poly * std::exp(-z * z);
+      return x >= 0 ? r : 2.0 - r;
+    }
+#else
+    inline double erfc(double x) { return std::erfc(x); }
+#endif
+
+    /// One sided Mann-Whitney U test.
+    /// Returns the probability of current being at least this slow if both sets of samples came from the
+    /// same distribution, small values mean that current is slower than baseline.
+    inline double mann_whitney_p(const std::vector<double>& baseline, const std::vector<double>& current) {
+      const std::size_t n1 = baseline.size();
+      const std::size_t n2 = current.size();
+      if (n1 == 0 || n2 == 0) {
+        return 1;
+      }
+
+      // Exact probability for a single sample: its rank among the n1 + 1 values.
+      if (n2 == 1) {
+        std::size_t not_faster = 1;
+        for (std::size_t i = 0; i < n1; i++) {
+          not_faster += baseline[i] >= current[0] ? 1 : 0;
+        }
+        return static_cast<double>(not_faster) / static_cast<double>(n1 + 1);
+      }
+
+      std::vector<std::pair<double, bool> > values;
+      values.reserve(n1 + n2);
+      for (std::size_t i = 0; i < n1; i++) {
+        values.push_back(std::make_pair(baseline[i], false));
+      }
+      for (std::size_t i = 0; i < n2; i++) {
+        values.push_back(std::make_pair(current[i], true));
+      }
+      std::sort(values.begin(), values.end());
+
+      // Sum of the ranks of current, tied values get their average rank.
+      const std::size_t n = values.size();
+      double rank_sum = 0;
+      double ties = 0;
+      for (std::size_t i = 0; i < n;) {
+        std::size_t j = i;
+        while (j < n && values[j].first == values[i].first) {
+          j++;
+        }
+
+        const double rank = 0.5 * static_cast<double>(i + j + 1);
+        const double t = static_cast<double>(j - i);
+        ties += t * t * t - t;
+
+        for (std::size_t k = i; k < j; k++) {
+          rank_sum += values[k].second ? rank : 0;
+        }
+        i = j;
+      }
+
+      const double fn1 = static_cast<double>(n1);
+      const double fn2 = static_cast<double>(n2);
+      const double fn = static_cast<double>(n);
+      const double u = rank_sum - fn2 * (fn2 + 1) * 0.5;
+      const double mean = fn1 * fn2 * 0.5;
+      const double variance = fn1 * fn2 / 12.0 * ((fn + 1) - ties / (fn * (fn - 1)));
+
+      if (variance <= 0) {
+        return u > mean ? 0 : 1;
+      }
+
+      // Normal approximation with continuity correction.
+      const double z = (u - mean - 0.5) / std::sqrt(variance);
+      return 0.5 * detail::erfc(z / std::sqrt(2.0));
+    }
+  } // namespace detail
+
+  // MARK: - Golden files -
+
+  namespace detail {
+    /// Read-only view of a whole file.
+    /// The file is memory mapped on POSIX systems and read into memory elsewhere.
+    class mapped_file {
+    public:
+      inline mapped_file()
+          : m_data(NANO_TEST_NULLPTR)
+          , m_size(0)
+          , m_mapped(false) {}
+
+      inline ~mapped_file() { close(); }
+
+      /// Returns false when the file cannot be opened or read.
+      inline bool open(const char* path) {
+        close();
+
+#ifdef NANO_TEST_HAS_POSIX
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+          return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+          ::close(fd);
+          return false;
+        }
+
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size == 0) {
+          ::close(fd);
+          return true;
+        }
+
+        void* data = ::mmap(NANO_TEST_NULLPTR, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+          m_size = 0;
+          return false;
+        }
+
+        // Compared front to back once.
+        ::madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const unsigned char*>(data);
+        m_mapped = true;
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+          return false;
+        }
+
+        m_buffer.resize(static_cast<std::size_t>(file.tellg()));
+        file.seekg(0);
+        if (!m_buffer.empty() && !file.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size())) {
+          m_buffer.clear();
+          return false;
+        }
+
+        m_data = m_buffer.empty() ? NANO_TEST_NULLPTR : &m_buffer[0];
+        m_size = m_buffer.size();
+        return true;
+#endif
+      }
+
+      inline void close() {
+#ifdef NANO_TEST_HAS_POSIX
+        if (m_mapped) {
+          ::munmap(const_cast<unsigned char*>(m_data), m_size);
+        }
+#else
+        m_buffer.clear();
+#endif
+        m_data = NANO_TEST_NULLPTR;
+        m_size = 0;
+        m_mapped = false;
+      }
+
+      inline const unsigned char* data() const { return m_data; }
+      inline std::size_t size() const { return m_size; }
+
+    private:
+      mapped_file(const mapped_file&);
+      mapped_file& operator=(const mapped_file&);
+
+      const unsigned char* m_data;
+      std::size_t m_size;
+      bool m_mapped;
+#ifndef NANO_TEST_HAS_POSIX
+      std::vector<unsigned char> m_buffer;
+#endif
+    };
+  } // namespace detail
+
+  // MARK: - Execution cache -
+
+  namespace detail {
+    inline unsigned long long fnv1a(
+        const void* data, std::size_t size, unsigned long long hash = 14695981039346656037ULL) {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      for (std::size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+      }
+      return hash;
+    }
+
+    /// Path of the running executable, argv0 when it cannot be resolved.
+    inline std::string executable_path(const char* argv0) {
+#if defined(__linux__)
+      char path[4096];
+      const ssize_t size = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+      if (size > 0) {
+        return std::string(path, static_cast<std::size_t>(size));
+      }
+#endif
+      return argv0;
+    }
+
+#if defined(__linux__)
+    /// dl_iterate_phdr callback hashing the NT_GNU_BUILD_ID note of the first object, the executable.
+    inline int hash_build_id(struct dl_phdr_info* info, std::size_t, void* data) {
+      unsigned long long& hash = *static_cast<unsigned long long*>(data);
+      for (std::size_t i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+        if (segment.p_type != PT_NOTE) {
+          continue;
+        }
+
+        const std::size_t align = segment.p_align == 8 ? 8 : 4;
+        const char* note = reinterpret_cast<const char*>(info->dlpi_addr + segment.p_vaddr);
+        const char* end = note + segment.p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+          const ElfW(Nhdr)* header = reinterpret_cast<const ElfW(Nhdr)*>(note);
+          const char* name = note + sizeof(ElfW(Nhdr));
+          const char* desc = name + ((header->n_namesz + align - 1) & ~(align - 1));
+          if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0
+              && desc + header->n_descsz <= end) {
+            hash = fnv1a(desc, header->n_descsz);
+            return 1;
+          }
+          note = desc + ((header->n_descsz + align - 1) & ~(align - 1));
+        }
+      }
+      return 1;
+    }
+#endif
+
+    /// Identity of the build mixed into the --incremental hashes: the GNU build id of the executable, or a
+    /// hash of the executable file when it has none. 0 when the executable cannot be read.
+    inline unsigned long long build_identity(const std::string& executable) {
+      unsigned long long hash = 0;
+#if defined(__linux__)
+      dl_iterate_phdr(&hash_build_id, &hash);
+#endif
+      if (hash == 0) {
+        mapped_file file;
+        if (file.open(executable.c_str())) {
+          hash = fnv1a(file.data(), file.size());
+        }
+      }
+      return hash;
+    }
+
+    /// Tests that passed in a previous run, read and written by --incremental.
+    ///
+    /// The file is stored in native byte order:
+    ///   char[4] magic "NTIC", uint32 version, uint64 entry count, then the entries sorted by name hash,
+    ///   each a uint64 hash of "group.name" and a uint64 hash of the test source file and the cache key.
+    class execution_cache {
+    public:
+      enum { version = 1, header_size = 16 };
+
+      inline execution_cache()
+          : m_count(0) {}
+
+      struct entry {
+        unsigned long long name;
+        unsigned long long content;
+
+        inline bool operator<(const entry& e) const { return name < e.name; }
+      };
+
+      /// Maps the cache, returns false when the file is missing or is not a cache of this version.
+      inline bool load(const std::string& path) {
+        unsigned int v = 0;
+        unsigned long long count = 0;
+        m_count = 0;
+
+        if (!m_file.open(path.c_str()) || m_file.size() < header_size || std::memcmp(m_file.data(), "NTIC", 4) != 0) {
+          return false;
+        }
+
+        std::memcpy(&v, m_file.data() + 4, sizeof(v));
+        std::memcpy(&count, m_file.data() + 8, sizeof(count));
+        if (v != version || m_file.size() != header_size + count * sizeof(entry)) {
+          return false;
+        }
+
+        m_count = static_cast<std::size_t>(count);
+        return true;
+      }
+
+      /// True when the test passed in a previous run with the same content hash.
+      inline bool passed(unsigned long long name, unsigned long long content) const {
+        std::size_t first = 0;
+        std::size_t last = m_count;
+        while (first < last) {
+          const std::size_t mid = first + (last - first) / 2;
+          const entry e = at(mid);
+          if (e.name == name) {
+            return e.content == content;
+          }
+
+          if (e.name < name) {
+            first = mid + 1;
+          }
+          else {
+            last = mid;
+          }
+        }
+        return false;
+      }
+
+      /// Writes the passes of this run and the previous entries of the tests that did not run.
+      /// ran must be sorted.
+      inline bool save(
+          const std::string& path, std::vector<entry> passes, const std::vector<unsigned long long>& ran) const {
+        for (std::size_t i = 0; i < m_count; i++) {
+          const entry e = at(i);
+          if (!std::binary_search(ran.begin(), ran.end(), e.name)) {
+            passes.push_back(e);
+          }
+        }
+
+        std::sort(passes.begin(), passes.end());
+
+        const unsigned int v = version;
+        const unsigned long long count = passes.size();
+        std::vector<unsigned char> data(header_size + passes.size() * sizeof(entry));
+        std::memcpy(&data[0], "NTIC", 4);
+        std::memcpy(&data[4], &v, sizeof(v));
+        std::memcpy(&data[8], &count, sizeof(count));
+        if (!passes.empty()) {
+          std::memcpy(&data[header_size], &passes[0], passes.size() * sizeof(entry));
+        }
+
+        return write_file_atomic(path.c_str(), &data[0], data.size());
+      }
+
+    private:
+      mapped_file m_file;
+      std::size_t m_count;
+
+      inline entry at(std::size_t i) const {
+        entry e;
+        std::memcpy(&e, m_file.data() + header_size + i * sizeof(entry), sizeof(entry));
+        return e;
+      }
+    };
+  } // namespace detail
+
+  // MARK: - Journal -
+
+  namespace detail {
+    /// Record of a --journal file.
+    ///
+    /// The file starts with a header record (char[8] magic "NTJOURNL", uint32 version, uint32 record size,
+    /// uint64 capacity in records, uint64 next free record) followed by records in native byte order.
+    /// Strings are referenced by the index of their string record, tests by the index of their begin_test
+    /// record.
+    struct journal_record {
+      enum record_type {
+        empty,
+
+        /// a: length, the bytes fill the next (a + 31) / 32 records.
+        string,
+
+        /// b: group, c: name, d: start in ns since the journal was opened.
+        begin_test,
+
+        /// a: line, b: test, c: expression, d: file (0 for a failed ASSERT, the expression is its message).
+        check_failed,
+
+        /// a: passed, b: test, c: duration in ns, d: checks << 32 | failed checks.
+        end_test,
+
+        /// a: signal (0 when a shard process exited), b: group, c: name of the test that was running.
+        crash,
+
+        /// b: group, c: name, d: timeout in ns.
+        timed_out,
+
+        /// a: 1 when a crash or a timeout aborted the run, b: passed tests, c: failed tests (both 0 after a
+        /// crash), d: duration in ns. Always the last record of a run.
+        end_run,
+
+        /// a: samples, b: test, c: median in ns as the bits of a double, d: iterations per sample.
+        benchmark
+      };
+
+      unsigned int type;
+      unsigned int a;
+      unsigned long long b;
+      unsigned long long c;
+      unsigned long long d;
     };
 
-    static inline void release_instance() {
-      manager*& ptr = get_instance_ptr();
-      delete ptr;
-      ptr = nullptr;
-    }
+    /// Preallocated, memory mapped file the results are written to while the tests run.
+    ///
+    /// A record is filled with plain stores into the shared mapping and its type is stored last, so a
+    /// reader following the run, or reading the file after the process died, stops at the first record
+    /// that is still empty. The next free record is an atomic in the header, shared by the shard
+    /// processes. Writing the crash record only reserves a slot and stores into it, which is
+    /// async-signal-safe. The file is truncated to the records written when it is closed.
+    class journal {
+    public:
+      enum { version = 1, default_capacity = 1 << 21 };
+
+      inline journal()
+          : m_records(NANO_TEST_NULLPTR)
+          , m_capacity(0)
+          , m_next(NANO_TEST_NULLPTR)
+          , m_fd(-1) {}
+
+      inline ~journal() { close(); }
+
+      /// Creates the file with room for capacity records, returns false when it cannot be mapped.
+      inline bool open(const char* path, std::size_t capacity = default_capacity) {
+        close();
+
+#ifdef NANO_TEST_HAS_POSIX
+        const int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+          return false;
+        }
+
+        // The file is sparse, the pages are only allocated once written.
+        const std::size_t size = capacity * sizeof(journal_record);
+        void* data = MAP_FAILED;
+        if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+          data = ::mmap(NANO_TEST_NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+
+        if (data == MAP_FAILED) {
+          ::close(fd);
+          return false;
+        }
+
+        m_fd = fd;
+        m_records = static_cast<journal_record*>(data);
+        m_capacity = capacity;
+        m_start_time = clock::now();
+
+        char* header = reinterpret_cast<char*>(m_records);
+        const unsigned int v = version;
+        const unsigned int record_size = sizeof(journal_record);
+        const unsigned long long records = capacity;
+        std::memcpy(header, "NTJOURNL", 8);
+        std::memcpy(header + 8, &v, sizeof(v));
+        std::memcpy(header + 12, &record_size, sizeof(record_size));
+        std::memcpy(header + 16, &records, sizeof(records));
+#ifdef NANO_TEST_HAS_THREADS
+        m_next = new (header + 24) std::atomic<unsigned long long>(1);
+#else
+        m_next = reinterpret_cast<unsigned long long*>(header + 24);
+        *m_next = 1;
+#endif
+        return true;
+#else
+        (void)path;
+        (void)capacity;
+        return false;
+#endif
+      }
+
+      inline void close() {
+#ifdef NANO_TEST_HAS_POSIX
+        if (!m_records) {
+          return;
+        }
+
+        const std::size_t used = static_cast<std::size_t>(std::min<unsigned long long>(*m_next, m_capacity));
+        ::munmap(m_records, m_capacity * sizeof(journal_record));
+
+        // The records are complete either way, a failure only leaves the unused tail in the file.
+        const int truncated = ::ftruncate(m_fd, static_cast<off_t>(used * sizeof(journal_record)));
+        (void)truncated;
+        ::close(m_fd);
+
+        m_records = NANO_TEST_NULLPTR;
+        m_capacity = 0;
+        m_next = NANO_TEST_NULLPTR;
+        m_fd = -1;
+        m_strings.clear();
+        m_names.clear();
+#endif
+      }
+
+      inline bool is_open() const { return m_records != NANO_TEST_NULLPTR; }
+
+      /// Writes the group and test names before the tests run, begin_test then finds them without locking.
+      /// Must not be called while tests run.
+      inline void write_names(const std::vector<const char*>& names) {
+        for (std::size_t i = 0; i < names.size(); i++) {
+          m_names.push_back(std::make_pair(names[i], intern(names[i])));
+        }
+        std::sort(m_names.begin(), m_names.end());
+      }
+
+      inline unsigned long long begin_test(const char* group, const char* name) {
+        const unsigned long long g = name_string(group);
+        const unsigned long long n = name_string(name);
+        return write(journal_record::begin_test, 0, g, n, elapsed_ns());
+      }
+
+      NANO_TEST_COLD inline void check_failed(unsigned long long test, const char* expr, const char* file,
+          std::size_t line) {
+        const unsigned long long e = intern(expr);
+        const unsigned long long f = intern(file);
+        write(journal_record::check_failed, static_cast<unsigned int>(line), test, e, f);
+      }
+
+      /// Failed ASSERT, the message is built at run time and written every time.
+      NANO_TEST_COLD inline void assert_failed(unsigned long long test, const char* what) {
+        write(journal_record::check_failed, 0, test, write_string(what), 0);
+      }
+
+      inline void end_test(
+          unsigned long long test, bool passed, double ns, std::size_t checks, std::size_t failed_checks) {
+        const unsigned long long counts
+            = (static_cast<unsigned long long>(checks) << 32) | (failed_checks & 0xFFFFFFFFULL);
+        write(journal_record::end_test, passed ? 1 : 0, test, static_cast<unsigned long long>(ns), counts);
+      }
+
+      /// Called from the crash handlers with the begin_test record of the test, only loads and stores.
+      inline void crash(int signal, unsigned long long test) {
+        write(journal_record::crash, static_cast<unsigned int>(signal), group_of(test), name_of(test), 0);
+      }
+
+      /// Crash of a test that ran in a shard process.
+      inline void crash(int signal, const char* group, const char* name) {
+        write(journal_record::crash, static_cast<unsigned int>(signal), intern(group), intern(name), 0);
+      }
+
+      inline void timed_out(unsigned long long test, double timeout_ns) {
+        write(journal_record::timed_out, 0, group_of(test), name_of(test), static_cast<unsigned long long>(timeout_ns));
+      }
+
+      inline void timed_out(const char* group, const char* name, double timeout_ns) {
+        write(journal_record::timed_out, 0, intern(group), intern(name), static_cast<unsigned long long>(timeout_ns));
+      }
+
+      inline void benchmark(unsigned long long test, std::size_t samples, double median_ns, std::size_t iterations) {
+        unsigned long long median = 0;
+        std::memcpy(&median, &median_ns, sizeof(median));
+        write(journal_record::benchmark, static_cast<unsigned int>(samples), test, median, iterations);
+      }
+
+      inline void end_run(std::size_t passed, std::size_t failed, double ns, bool aborted = false) {
+        write(journal_record::end_run, aborted ? 1 : 0, passed, failed, static_cast<unsigned long long>(ns));
+      }
+
+      /// Called from the crash handlers after crash, ends the run so a reader following it stops.
+      inline void abort_run() { write(journal_record::end_run, 1, 0, 0, elapsed_ns()); }
+
+    private:
+      journal_record* m_records;
+      std::size_t m_capacity;
+#ifdef NANO_TEST_HAS_THREADS
+      std::atomic<unsigned long long>* m_next;
+      std::mutex m_strings_mutex;
+#else
+      unsigned long long* m_next;
+#endif
+      int m_fd;
+      clock::tick_type m_start_time;
+
+      /// Record of the strings already written, by address. Test names and check expressions are literals.
+      std::map<const char*, unsigned long long> m_strings;
+
+      /// Strings of write_names sorted by address, read only while the tests run.
+      std::vector<std::pair<const char*, unsigned long long> > m_names;
+
+      inline unsigned long long elapsed_ns() const {
+        return static_cast<unsigned long long>(clock::elapsed_ns(m_start_time));
+      }
+
+      /// First of count consecutive records, 0 once the journal is full.
+      inline std::size_t reserve(std::size_t count) {
+        if (!m_records) {
+          return 0;
+        }
+
+#ifdef NANO_TEST_HAS_THREADS
+        const unsigned long long index = m_next->fetch_add(count, std::memory_order_relaxed);
+#else
+        const unsigned long long index = *m_next;
+        *m_next += count;
+#endif
+        return index + count <= m_capacity ? static_cast<std::size_t>(index) : 0;
+      }
+
+      inline unsigned long long group_of(unsigned long long test) const { return test ? m_records[test].b : 0; }
+      inline unsigned long long name_of(unsigned long long test) const { return test ? m_records[test].c : 0; }
+
+      inline void publish(journal_record& r, unsigned int type) {
+#ifdef NANO_TEST_HAS_THREADS
+        std::atomic_thread_fence(std::memory_order_release);
+#endif
+        *static_cast<volatile unsigned int*>(&r.type) = type;
+      }
+
+      inline unsigned long long write(unsigned int type, unsigned int a, unsigned long long b, unsigned long long c,
+          unsigned long long d) {
+        const std::size_t index = reserve(1);
+        if (!index) {
+          return 0;
+        }
+
+        journal_record& r = m_records[index];
+        r.a = a;
+        r.b = b;
+        r.c = c;
+        r.d = d;
+        publish(r, type);
+        return index;
+      }
+
+      inline unsigned long long write_string(const char* str) {
+        const std::size_t length = std::strlen(str);
+        const std::size_t index = reserve(1 + (length + sizeof(journal_record) - 1) / sizeof(journal_record));
+        if (!index) {
+          return 0;
+        }
+
+        std::memcpy(&m_records[index + 1], str, length);
+        journal_record& r = m_records[index];
+        r.a = static_cast<unsigned int>(length);
+        publish(r, journal_record::string);
+        return index;
+      }
+
+      inline unsigned long long name_string(const char* str) {
+        const std::pair<const char*, unsigned long long> key(str, 0);
+        std::vector<std::pair<const char*, unsigned long long> >::const_iterator it
+            = std::lower_bound(m_names.begin(), m_names.end(), key);
+        return it != m_names.end() && it->first == str ? it->second : intern(str);
+      }
+
+      inline unsigned long long intern(const char* str) {
+#ifdef NANO_TEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_strings_mutex);
+#endif
+        std::map<const char*, unsigned long long>::const_iterator it = m_strings.find(str);
+        if (it != m_strings.end()) {
+          return it->second;
+        }
+
+        const unsigned long long index = write_string(str);
+        m_strings[str] = index;
+        return index;
+      }
+
+      journal(const journal&);
+      journal& operator=(const journal&);
+    };
+  } // namespace detail
+
+  // MARK: - Output -
+
+  namespace detail {
+    /// Writes str as a quoted JSON string.
+    inline void write_json_string(std::ostream& os, const char* str) {
+      static const char hex[] = "0123456789abcdef";
+
+      os << '"';
+      for (const char* c = str; *c; ++c) {
+        switch (*c) {
+        case '"':
+          os << "\\\"";
+          break;
+        case '\\':
+          os << "\\\\";
+          break;
+        case '\n':
+          os << "\\n";
+          break;
+        case '\t':
+          os << "\\t";
+          break;
+        default:
+          if (static_cast<unsigned char>(*c) < 0x20) {
+            os << "\\u00" << hex[(*c >> 4) & 0xF] << hex[*c & 0xF];
+          }
+          else {
+            os << *c;
+          }
+        }
+      }
+      os << '"';
+    }
+
+    /// Writes str escaped for an XML attribute or text.
+    inline void write_xml_string(std::ostream& os, const char* str) {
+      for (const char* c = str; *c; ++c) {
+        switch (*c) {
+        case '&':
+          os << "&amp;";
+          break;
+        case '<':
+          os << "&lt;";
+          break;
+        case '>':
+          os << "&gt;";
+          break;
+        case '"':
+          os << "&quot;";
+          break;
+        case '\n':
+          os << "&#10;";
+          break;
+        default:
+          os << *c;
+        }
+      }
+    }
+
+#ifdef NANO_TEST_HAS_POSIX
+    inline bool write_all(int fd, const void* data, std::size_t size) {
+      const char* ptr = static_cast<const char*>(data);
+
+      while (size) {
+        const ssize_t n = ::write(fd, ptr, size);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+
+        ptr += n;
+        size -= static_cast<std::size_t>(n);
+      }
+
+      return true;
+    }
+
+    inline bool is_terminal_output() { return ::isatty(STDOUT_FILENO) != 0; }
+
+    inline void write_stdout(const char* data, std::size_t size) { write_all(STDOUT_FILENO, data, size); }
+#else
+    inline bool is_terminal_output() { return true; }
+
+    inline void write_stdout(const char* data, std::size_t size) {
+      std::fwrite(data, 1, size, stdout);
+      std::fflush(stdout);
+    }
+#endif // NANO_TEST_HAS_POSIX
+
+#ifdef NANO_TEST_HAS_THREADS
+    /// Address unique to the calling thread.
+    inline const void* current_thread_token() {
+      static thread_local char token = 0;
+      return &token;
+    }
+
+    /// Stream buffer of the test running on a --jobs worker, printed once the test ends.
+    ///
+    /// The latest output is kept in a preallocated buffer, older output moves to a string when it is full.
+    /// Every instance is registered, so that the crash handlers can write the output of the tests in
+    /// flight and name them (write_busy) with async-signal-safe calls only.
+    class test_output : public std::streambuf {
+    public:
+      enum { capacity = 16 * 1024 };
+
+      inline test_output()
+          : m_next(NANO_TEST_NULLPTR)
+          , m_owner(NANO_TEST_NULLPTR)
+          , m_group(NANO_TEST_NULLPTR)
+          , m_test(NANO_TEST_NULLPTR)
+          , m_size(0) {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        m_next = registry();
+        registry() = this;
+      }
+
+      inline ~test_output() NANO_TEST_OVERRIDE {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        test_output** it = &registry();
+        while (*it != this) {
+          it = &(*it)->m_next;
+        }
+        *it = m_next;
+      }
+
+      /// Starts the output of a test run by the calling thread.
+      inline void begin(const char* group, const char* test) {
+        m_spilled.clear();
+        m_size = 0;
+        m_owner = current_thread_token();
+        m_group.store(group, std::memory_order_relaxed);
+        m_test.store(test, std::memory_order_release);
+      }
+
+      /// Writes the output of the test to os and ends it.
+      inline void end(std::ostream& os) {
+        os.write(m_spilled.data(), static_cast<std::streamsize>(m_spilled.size()));
+        os.write(m_data, static_cast<std::streamsize>(m_size));
+        m_test.store(NANO_TEST_NULLPTR, std::memory_order_relaxed);
+      }
+
+      /// Writes the output of every test in flight to stdout, each followed by a failure naming the test.
+      /// Called by the crash handlers, the test running on the crashing thread is reported as crashed.
+      static inline void write_busy(int sig) {
+        for (test_output* o = registry(); o; o = o->m_next) {
+          const char* test = o->m_test.load(std::memory_order_acquire);
+          if (!test) {
+            continue;
+          }
+
+          message_buffer<512> message;
+          if (!o->m_spilled.empty()) {
+            message << "    > (" << static_cast<unsigned long long>(o->m_spilled.size())
+                    << " bytes of earlier output are lost)\n";
+          }
+          write_stdout(message.c_str(), message.size());
+          write_stdout(o->m_data, o->m_size);
+
+          message_buffer<512> failure;
+          if (o->m_owner == current_thread_token()) {
+            failure << "    > Test crashed with signal " << sig << "\n";
+          }
+          else {
+            failure << "    > Test was running when the process crashed with signal " << sig << "\n";
+          }
+          failure << kFailed << " < test case " << test << " from '" << o->m_group.load(std::memory_order_relaxed)
+                  << "' (crashed)\n";
+          write_stdout(failure.c_str(), failure.size());
+        }
+      }
+
+    protected:
+      inline virtual int_type overflow(int_type c) NANO_TEST_OVERRIDE {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+          const char ch = traits_type::to_char_type(c);
+          append(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+      }
+
+      inline virtual std::streamsize xsputn(const char* s, std::streamsize n) NANO_TEST_OVERRIDE {
+        append(s, static_cast<std::size_t>(n));
+        return n;
+      }
+
+    private:
+      test_output* m_next;
+      const void* m_owner;
+      std::atomic<const char*> m_group;
+      std::atomic<const char*> m_test;
+      std::size_t m_size;
+      char m_data[capacity];
+      std::string m_spilled;
+
+      static inline test_output*& registry() {
+        static test_output* head = NANO_TEST_NULLPTR;
+        return head;
+      }
+
+      static inline std::mutex& registry_mutex() {
+        static std::mutex m;
+        return m;
+      }
+
+      inline void append(const char* s, std::size_t n) {
+        if (m_size + n > capacity) {
+          m_spilled.append(m_data, m_size);
+          m_size = 0;
+
+          if (n > capacity) {
+            m_spilled.append(s, n);
+            return;
+          }
+        }
+
+        std::memcpy(m_data + m_size, s, n);
+        m_size += n;
+      }
+
+      test_output(const test_output&);
+      test_output& operator=(const test_output&);
+    };
+#endif
+
+    /// Stream buffer that replaces the one of std::cout while the tests run.
+    ///
+    /// Everything written to std::cout, by the runner or by the tests, is copied into a preallocated
+    /// buffer that is written to stdout in one call when it is full, at the end of the run or when
+    /// the process crashes. In immediate mode every flush (std::flush, std::endl) also writes it.
+    /// There is no put area, so every write goes through xsputn() and can be serialized.
+    class output_buffer : public std::streambuf {
+    public:
+      enum { capacity = 64 * 1024 };
+
+      inline output_buffer()
+          : m_previous(NANO_TEST_NULLPTR)
+          , m_size(0)
+          , m_immediate(true) {}
+
+      inline ~output_buffer() NANO_TEST_OVERRIDE {
+        if (m_previous) {
+          detach();
+        }
+      }
+
+      inline void attach(bool immediate) {
+        m_immediate = immediate;
+        m_previous = std::cout.rdbuf(this);
+        active() = this;
+        install_crash_handlers();
+      }
+
+      inline void detach() {
+        write_pending();
+        restore_crash_handlers();
+        std::cout.rdbuf(m_previous);
+        m_previous = NANO_TEST_NULLPTR;
+        active() = NANO_TEST_NULLPTR;
+      }
+
+      /// Writes the buffered output to stdout, regardless of the mode.
+      inline void write_pending() {
+#ifdef NANO_TEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+        write_unlocked();
+      }
+
+      /// Buffer attached to std::cout, if any.
+      static inline output_buffer*& active() {
+        static output_buffer* buffer = NANO_TEST_NULLPTR;
+        return buffer;
+      }
+
+      typedef void (*crash_hook_type)(int);
+
+      /// Called with the signal by the crash handlers before the output is written, must be async-signal-safe.
+      static inline crash_hook_type& crash_hook() {
+        static crash_hook_type hook = NANO_TEST_NULLPTR;
+        return hook;
+      }
+
+    protected:
+      inline virtual int_type overflow(int_type c) NANO_TEST_OVERRIDE {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+          const char ch = traits_type::to_char_type(c);
+          append(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+      }
+
+      inline virtual std::streamsize xsputn(const char* s, std::streamsize n) NANO_TEST_OVERRIDE {
+        append(s, static_cast<std::size_t>(n));
+        return n;
+      }
+
+      inline virtual int sync() NANO_TEST_OVERRIDE {
+        if (m_immediate) {
+          write_pending();
+        }
+        return 0;
+      }
+
+    private:
+      std::streambuf* m_previous;
+#ifdef NANO_TEST_HAS_THREADS
+      std::mutex m_mutex;
+#endif
+      std::size_t m_size;
+      bool m_immediate;
+      char m_data[capacity];
+
+      inline void append(const char* s, std::size_t n) {
+#ifdef NANO_TEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+        if (m_size + n > capacity) {
+          write_unlocked();
+
+          if (n > capacity) {
+            write_stdout(s, n);
+            return;
+          }
+        }
+
+        std::memcpy(m_data + m_size, s, n);
+        m_size += n;
+      }
+
+      // Only uses write(2), so it can be called from a signal handler.
+      inline void write_unlocked() {
+        if (m_size) {
+          write_stdout(m_data, m_size);
+          m_size = 0;
+        }
+      }
+
+      static inline void flush_active() {
+        if (output_buffer* b = active()) {
+          b->write_unlocked();
+        }
+      }
+
+      enum { signal_count = 4 };
+
+      static inline const int* crash_signals() {
+        static const int signals[signal_count] = { SIGABRT, SIGFPE, SIGILL, SIGSEGV };
+        return signals;
+      }
+
+      static inline bool& handlers_installed() {
+        static bool installed = false;
+        return installed;
+      }
+
+#ifdef NANO_TEST_HAS_POSIX
+      enum { alternate_stack_size = 64 * 1024 };
+
+      /// Actions the crash handlers replaced, restored by detach and chained to on a crash.
+      static inline struct sigaction* previous_actions() {
+        static struct sigaction actions[signal_count];
+        return actions;
+      }
+
+      /// True when the runner thread uses the alternate stack of the crash handlers.
+      static inline bool& own_stack() {
+        static bool own = false;
+        return own;
+      }
+
+      /// Flushes the output and hands the signal over to the handler that was installed before, e.g. the
+      /// one of a sanitizer. A fault returns to the faulting instruction, which faults again into that
+      /// handler with its original address. A raised signal is raised again and delivered once this
+      /// handler returns.
+      static inline void crash_handler(int sig, siginfo_t* info, void*) {
+        if (crash_hook_type hook = crash_hook()) {
+          hook(sig);
+        }
+        flush_active();
+#ifdef NANO_TEST_HAS_THREADS
+        test_output::write_busy(sig);
+#endif
+
+        const int* signals = crash_signals();
+        for (std::size_t i = 0; i < signal_count; i++) {
+          if (signals[i] == sig) {
+            ::sigaction(sig, &previous_actions()[i], NANO_TEST_NULLPTR);
+          }
+        }
+
+        if (info && info->si_code > 0) {
+          return;
+        }
+        ::raise(sig);
+      }
+
+      static inline void install_crash_handlers() {
+        if (handlers_installed()) {
+          return;
+        }
+        handlers_installed() = true;
+
+        static bool registered = false;
+        if (!registered) {
+          registered = true;
+          std::atexit(&flush_active);
+        }
+
+        // A stack overflow can only be handled on another stack, given to the runner thread unless it has one.
+        static char alternate_stack[alternate_stack_size];
+        stack_t current;
+        if (::sigaltstack(NANO_TEST_NULLPTR, &current) == 0 && (current.ss_flags & SS_DISABLE)) {
+          stack_t stack;
+          stack.ss_sp = alternate_stack;
+          stack.ss_size = sizeof(alternate_stack);
+          stack.ss_flags = 0;
+          own_stack() = ::sigaltstack(&stack, NANO_TEST_NULLPTR) == 0;
+        }
+
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &crash_handler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+
+        const int* signals = crash_signals();
+        for (std::size_t i = 0; i < signal_count; i++) {
+          ::sigaction(signals[i], &action, &previous_actions()[i]);
+        }
+      }
+
+      static inline void restore_crash_handlers() {
+        if (!handlers_installed()) {
+          return;
+        }
+        handlers_installed() = false;
+
+        const int* signals = crash_signals();
+        for (std::size_t i = 0; i < signal_count; i++) {
+          ::sigaction(signals[i], &previous_actions()[i], NANO_TEST_NULLPTR);
+        }
+
+        if (own_stack()) {
+          stack_t stack;
+          std::memset(&stack, 0, sizeof(stack));
+          stack.ss_flags = SS_DISABLE;
+          ::sigaltstack(&stack, NANO_TEST_NULLPTR);
+          own_stack() = false;
+        }
+      }
+#else
+      typedef void (*signal_handler)(int);
+
+      static inline signal_handler* previous_handlers() {
+        static signal_handler handlers[signal_count];
+        return handlers;
+      }
+
+      static inline void crash_handler(int sig) {
+        if (crash_hook_type hook = crash_hook()) {
+          hook(sig);
+        }
+        flush_active();
+#ifdef NANO_TEST_HAS_THREADS
+        test_output::write_busy(sig);
+#endif
+        std::signal(sig, SIG_DFL);
+        std::raise(sig);
+      }
+
+      static inline void install_crash_handlers() {
+        if (handlers_installed()) {
+          return;
+        }
+        handlers_installed() = true;
+
+        static bool registered = false;
+        if (!registered) {
+          registered = true;
+          std::atexit(&flush_active);
+        }
+
+        const int* signals = crash_signals();
+        for (std::size_t i = 0; i < signal_count; i++) {
+          previous_handlers()[i] = std::signal(signals[i], &crash_handler);
+        }
+      }
+
+      static inline void restore_crash_handlers() {
+        if (!handlers_installed()) {
+          return;
+        }
+        handlers_installed() = false;
+
+        const int* signals = crash_signals();
+        for (std::size_t i = 0; i < signal_count; i++) {
+          std::signal(signals[i], previous_handlers()[i] == SIG_ERR ? SIG_DFL : previous_handlers()[i]);
+        }
+      }
+#endif
+
+      output_buffer(const output_buffer&);
+      output_buffer& operator=(const output_buffer&);
+    };
+  } // namespace detail
+
+  // MARK: - Reporters -
+
+  /// Errors of a failed EXPECT_RANGE_FLOAT_EQ or EXPECT_RANGE_ULP_EQ.
+  struct range_error {
+    inline range_error()
+        : mismatch_count(0)
+        , worst_index(0)
+        , max_abs_error(0)
+        , max_rel_error(0)
+        , max_ulps(0) {}
+
+    std::size_t mismatch_count;
+
+    /// Mismatching element with the largest error (in ulps for EXPECT_RANGE_ULP_EQ).
+    std::size_t worst_index;
+
+    double max_abs_error;
+    double max_rel_error;
+    unsigned long long max_ulps;
+  };
+
+  /// Receives the events of a test run and prints them.
+  ///
+  /// Every event gets the stream to print to. The output of a test running on a worker thread or
+  /// in a shard process goes to a buffer that is printed as one block once the test is done.
+  class reporter {
+  public:
+    virtual ~reporter() NANO_TEST_DEFAULT()
+
+    virtual void begin_run(std::ostream&, std::size_t, std::size_t) {}
+    virtual void begin_parallel(std::ostream&, std::size_t, std::size_t) {}
+    virtual void begin_shards(std::ostream&, std::size_t, std::size_t) {}
+    virtual void begin_group(std::ostream&, const std::string&, std::size_t) {}
+    virtual void end_group(std::ostream&, const std::string&, double) {}
+    virtual void begin_test(std::ostream&, const char*, const test_item&) {}
+    virtual void check_failed(std::ostream&, const char*, const char*, std::size_t) {}
+    virtual void exception_check_failed(std::ostream&, const char*, const char*, const char*, std::size_t) {}
+    virtual void assert_failed(std::ostream&, const char*) {}
+    virtual void performance_check_failed(std::ostream&, const char*, const char*, std::size_t, double, double) {}
+    virtual void range_check_failed(
+        std::ostream&, const char*, const char*, std::size_t, std::size_t, const std::string&, const std::string&) {}
+    virtual void golden_check_failed(
+        std::ostream&, const char*, const char*, const std::string&, const char*, std::size_t) {}
+    virtual void range_error_check_failed(std::ostream&, const char*, const char*, std::size_t, std::size_t,
+        const range_error&, const std::string&, const std::string&) {}
+    virtual void end_test(
+        std::ostream&, const char*, const test_item&, bool, std::size_t, std::size_t, double) {}
+    virtual void test_crashed(std::ostream&, const char*, const test_item&, const char*, int) {}
+    virtual void test_timed_out(std::ostream&, const char*, const test_item&, double) {}
+    virtual void benchmark(std::ostream&, const benchmark_result&) {}
+    virtual void regression(std::ostream&, const std::string&, bool, double, double, double) {}
+    virtual void baseline(std::ostream&, const char*, std::size_t, std::size_t, bool) {}
+    virtual void cached(std::ostream&, const char*, std::size_t) {}
+    virtual void uncached_source(std::ostream&, const char*) {}
+    virtual void stopped(std::ostream&, const char*, const char*) {}
+    virtual void unbound_checks_failed(std::ostream&, std::size_t) {}
+    virtual void end_run(std::ostream&, std::size_t, std::size_t, std::size_t, std::size_t, double) {}
+  };
+
+  /// Default reporter, prints a gtest like log.
+  class console_reporter : public reporter {
+  public:
+    virtual ~console_reporter() NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+    inline virtual void begin_run(
+        std::ostream& os, std::size_t test_count, std::size_t group_count) NANO_TEST_OVERRIDE {
+      os << "[==========] Running " << test_count << " " << tests(test_count) << " from " << group_count << " test "
+         << groups(group_count) << ".\n\n";
+    }
+
+    inline virtual void begin_parallel(
+        std::ostream& os, std::size_t test_count, std::size_t thread_count) NANO_TEST_OVERRIDE {
+      os << "[----------] " << test_count << " " << tests(test_count) << " on " << thread_count << " threads\n";
+    }
+
+    inline virtual void begin_shards(
+        std::ostream& os, std::size_t test_count, std::size_t shard_count) NANO_TEST_OVERRIDE {
+      os << "[----------] " << test_count << " " << tests(test_count) << " in " << shard_count << " shards\n";
+    }
+
+    inline virtual void begin_group(
+        std::ostream& os, const std::string& name, std::size_t test_count) NANO_TEST_OVERRIDE {
+      os << "[----------] " << test_count << " " << tests(test_count) << " from group '" << name << "'\n";
+    }
+
+    inline virtual void end_group(std::ostream& os, const std::string& name, double ns) NANO_TEST_OVERRIDE {
+      os << "[----------] group '" << name << "' (";
+      detail::print_ns(os, ns);
+      os << "). \n\n";
+    }
+
+    inline virtual void begin_test(std::ostream& os, const char*, const test_item& t) NANO_TEST_OVERRIDE {
+      os << "[ RUN      ] > test case " << t.name << " : " << t.desc << "\n";
+    }
+
+    inline virtual void check_failed(
+        std::ostream& os, const char* expr, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      detail::message_buffer<512> message(os);
+      message << "    > Check failed\n      expected : " << expr << "\n      source   : " << file
+              << "\n      line     : " << line << "\n";
+      message.flush();
+    }
+
+    inline virtual void exception_check_failed(std::ostream& os, const char* expected, const char* got,
+        const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      detail::message_buffer<512> message(os);
+      message << "    > Check exception failed\n      expected : " << expected << "\n      got      : " << got
+              << "\n      source   : " << file << "\n      line     : " << line << "\n";
+      message.flush();
+    }
+
+    inline virtual void assert_failed(std::ostream& os, const char* what) NANO_TEST_OVERRIDE {
+      os.write(what, static_cast<std::streamsize>(std::strlen(what)));
+    }
+
+    inline virtual void performance_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, double measured_ns, double limit_ns) NANO_TEST_OVERRIDE {
+      os << "    > Performance check failed\n      expected : " << expr << "\n      measured : ";
+      detail::print_ns(os, measured_ns);
+      os << " (median)\n      limit    : ";
+      detail::print_ns(os, limit_ns);
+      os << "\n      source   : " << file << "\n      line     : " << line << "\n";
+    }
+
+    inline virtual void range_check_failed(std::ostream& os, const char* expr, const char* file, std::size_t line,
+        std::size_t index, const std::string& a, const std::string& b) NANO_TEST_OVERRIDE {
+      os << "    > Check failed\n      expected : " << expr << "\n      mismatch : [" << index << "] " << a
+         << " vs " << b << "\n      source   : " << file << "\n      line     : " << line << "\n";
+    }
+
+    inline virtual void golden_check_failed(std::ostream& os, const char* expr, const char* path,
+        const std::string& error, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      os << "    > Check failed\n      expected : " << expr << "\n      golden   : " << path << "\n      error    : "
+         << error << "\n      source   : " << file << "\n      line     : " << line << "\n";
+    }
+
+    inline virtual void range_error_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, std::size_t size, const range_error& e, const std::string& a,
+        const std::string& b) NANO_TEST_OVERRIDE {
+      os << "    > Check failed\n      expected : " << expr << "\n      mismatch : " << e.mismatch_count << " of "
+         << size << " elements\n      worst    : [" << e.worst_index << "] " << a << " vs " << b
+         << "\n      max abs  : " << e.max_abs_error << "\n      max rel  : " << e.max_rel_error
+         << "\n      max ulps : " << e.max_ulps << "\n      source   : " << file << "\n      line     : " << line
+         << "\n";
+    }
+
+    inline virtual void end_test(std::ostream& os, const char*, const test_item& t, bool passed, std::size_t checks,
+        std::size_t failed_checks, double ns) NANO_TEST_OVERRIDE {
+      if (passed) {
+        os << detail::kOk << " < test case " << t.name << " (" << checks << " checks) (";
+      }
+      else {
+        os << detail::kFailed << " < test case " << t.name << " (" << (checks - failed_checks) << '/' << checks
+           << " checks) (";
+      }
+
+      detail::print_ns(os, ns);
+      os << ")\n";
+    }
+
+    inline virtual void test_crashed(
+        std::ostream& os, const char* group, const test_item& t, const char* reason, int code) NANO_TEST_OVERRIDE {
+      begin_test(os, group, t);
+      os << "    > " << reason << " " << code << "\n";
+      os << detail::kFailed << " < test case " << t.name << " (crashed)\n";
+    }
+
+    inline virtual void test_timed_out(
+        std::ostream& os, const char*, const test_item& t, double ns) NANO_TEST_OVERRIDE {
+      os << "    > Test timed out after ";
+      detail::print_ns(os, ns);
+      os << "\n" << detail::kFailed << " < test case " << t.name << " (timed out)\n";
+    }
+
+    inline virtual void benchmark(std::ostream& os, const benchmark_result& r) NANO_TEST_OVERRIDE {
+      os << "    > Benchmark : median ";
+      detail::print_ns(os, r.median_ns);
+      os << ", min ";
+      detail::print_ns(os, r.min_ns);
+      os << ", p99 ";
+      detail::print_ns(os, r.p99_ns);
+      os << ", mad ";
+      detail::print_ns(os, r.mad_ns);
+      os << ", ";
+      detail::print_rate(os, r.iterations_per_second);
+      os << " it/s (" << r.samples_ns.size() << " x " << r.iterations << " iterations)\n";
+    }
+
+    inline virtual void regression(std::ostream& os, const std::string& name, bool is_benchmark, double baseline_ns,
+        double current_ns, double p_value) NANO_TEST_OVERRIDE {
+      const std::ios_base::fmtflags flags = os.flags();
+      const std::streamsize precision = os.precision();
+
+      os << "[ REGRESS  ] " << (is_benchmark ? "benchmark " : "test case ") << name << " : median ";
+      detail::print_ns(os, baseline_ns);
+      os << " -> ";
+      detail::print_ns(os, current_ns);
+      os << std::fixed << std::setprecision(1) << " (+" << 100.0 * (current_ns / baseline_ns - 1.0) << " %, p = "
+         << std::setprecision(4) << p_value << ")\n";
+
+      os.flags(flags);
+      os.precision(precision);
+    }
+
+    inline virtual void baseline(std::ostream& os, const char* path, std::size_t compared, std::size_t regressions,
+        bool saved) NANO_TEST_OVERRIDE {
+      os << "[ BASELINE ] " << compared << " " << (compared == 1 ? "timing" : "timings") << " compared with '" << path
+         << "', " << regressions << " " << (regressions == 1 ? "regression" : "regressions")
+         << (saved ? ", baseline saved.\n" : ".\n");
+    }
+
+    inline virtual void cached(std::ostream& os, const char* path, std::size_t skipped) NANO_TEST_OVERRIDE {
+      os << "[ CACHED   ] " << skipped << " " << tests(skipped) << " unchanged since passing, skipped (cache '" << path
+         << "').\n";
+    }
+
+    inline virtual void uncached_source(std::ostream& os, const char* file) NANO_TEST_OVERRIDE {
+      os << "[ CACHED   ] Cannot read '" << file << "', its tests always run.\n";
+    }
+
+    inline virtual void stopped(std::ostream& os, const char* group, const char* test) NANO_TEST_OVERRIDE {
+      os << "\n[==========] Stopped in test case '" << test << "' from '" << group << "' group.\n\n\n";
+    }
+
+    inline virtual void unbound_checks_failed(std::ostream& os, std::size_t count) NANO_TEST_OVERRIDE {
+      os << detail::kFailed << " " << count << " " << (count == 1 ? "check" : "checks")
+         << " failed on threads not bound to a test, see nano::test::test_scope.\n";
+    }
+
+    inline virtual void end_run(std::ostream& os, std::size_t test_count, std::size_t group_count,
+        std::size_t passed_count, std::size_t failed_count, double ns) NANO_TEST_OVERRIDE {
+      os << "[==========] " << test_count << " " << tests(test_count) << " from " << group_count << " test "
+         << groups(group_count) << " (";
+      detail::print_ns(os, ns);
+      os << ").\n";
+
+      os << "[  PASSED  ] " << passed_count << " " << tests(passed_count) << "\n";
+
+      if (failed_count) {
+        os << "[  FAILED  ] " << failed_count << " " << tests(failed_count) << "\n";
+      }
+    }
+
+  protected:
+    inline static NANO_TEST_CONSTEXPR const char* tests(std::size_t count) {
+      return count <= 1 ? detail::kTest : detail::kTests;
+    }
+
+    inline static NANO_TEST_CONSTEXPR const char* groups(std::size_t count) { return count <= 1 ? "group" : "groups"; }
+  };
+
+/// Forwards an event of tee_reporter to each of its reporters.
+#define NANO_TEST_TEE_FORWARD(Event)                                                                                   \
+  for (std::size_t i = 0; i < m_count; i++) {                                                                          \
+    m_reporters[i]->Event;                                                                                             \
+  }
+
+  /// Forwards every event to its reporters, e.g. the one printing to the console and a file_reporter.
+  /// Every event of reporter must be forwarded here.
+  class tee_reporter : public reporter {
+  public:
+    enum { max_reporters = 4 };
+
+    inline tee_reporter()
+        : m_count(0) {}
+
+    virtual ~tee_reporter() NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+    /// Returns false when max_reporters are already added.
+    inline bool add(reporter* r) {
+      if (m_count == max_reporters) {
+        return false;
+      }
+
+      m_reporters[m_count++] = r;
+      return true;
+    }
+
+    inline void clear() { m_count = 0; }
+
+    inline virtual void begin_run(std::ostream& os, std::size_t a, std::size_t b) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(begin_run(os, a, b))
+    }
+
+    inline virtual void begin_parallel(std::ostream& os, std::size_t a, std::size_t b) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(begin_parallel(os, a, b))
+    }
+
+    inline virtual void begin_shards(std::ostream& os, std::size_t a, std::size_t b) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(begin_shards(os, a, b))
+    }
+
+    inline virtual void begin_group(std::ostream& os, const std::string& name, std::size_t count) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(begin_group(os, name, count))
+    }
+
+    inline virtual void end_group(std::ostream& os, const std::string& name, double ns) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(end_group(os, name, ns))
+    }
+
+    inline virtual void begin_test(std::ostream& os, const char* group, const test_item& t) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(begin_test(os, group, t))
+    }
+
+    inline virtual void check_failed(
+        std::ostream& os, const char* expr, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(check_failed(os, expr, file, line))
+    }
+
+    inline virtual void exception_check_failed(std::ostream& os, const char* expected, const char* got,
+        const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(exception_check_failed(os, expected, got, file, line))
+    }
+
+    inline virtual void assert_failed(std::ostream& os, const char* what) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(assert_failed(os, what))
+    }
+
+    inline virtual void performance_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, double measured_ns, double limit_ns) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(performance_check_failed(os, expr, file, line, measured_ns, limit_ns))
+    }
+
+    inline virtual void range_check_failed(std::ostream& os, const char* expr, const char* file, std::size_t line,
+        std::size_t index, const std::string& a, const std::string& b) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(range_check_failed(os, expr, file, line, index, a, b))
+    }
+
+    inline virtual void golden_check_failed(std::ostream& os, const char* expr, const char* path,
+        const std::string& error, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(golden_check_failed(os, expr, path, error, file, line))
+    }
+
+    inline virtual void range_error_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, std::size_t size, const range_error& e, const std::string& a,
+        const std::string& b) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(range_error_check_failed(os, expr, file, line, size, e, a, b))
+    }
+
+    inline virtual void end_test(std::ostream& os, const char* group, const test_item& t, bool passed,
+        std::size_t checks, std::size_t failed_checks, double ns) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(end_test(os, group, t, passed, checks, failed_checks, ns))
+    }
+
+    inline virtual void test_crashed(
+        std::ostream& os, const char* group, const test_item& t, const char* reason, int code) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(test_crashed(os, group, t, reason, code))
+    }
+
+    inline virtual void test_timed_out(
+        std::ostream& os, const char* group, const test_item& t, double ns) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(test_timed_out(os, group, t, ns))
+    }
+
+    inline virtual void benchmark(std::ostream& os, const benchmark_result& r) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(benchmark(os, r))
+    }
+
+    inline virtual void regression(std::ostream& os, const std::string& name, bool is_benchmark, double baseline_ns,
+        double current_ns, double p_value) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(regression(os, name, is_benchmark, baseline_ns, current_ns, p_value))
+    }
+
+    inline virtual void baseline(std::ostream& os, const char* path, std::size_t compared, std::size_t regressions,
+        bool saved) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(baseline(os, path, compared, regressions, saved))
+    }
+
+    inline virtual void cached(std::ostream& os, const char* path, std::size_t skipped) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(cached(os, path, skipped))
+    }
+
+    inline virtual void uncached_source(std::ostream& os, const char* file) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(uncached_source(os, file))
+    }
+
+    inline virtual void stopped(std::ostream& os, const char* group, const char* test) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(stopped(os, group, test))
+    }
+
+    inline virtual void unbound_checks_failed(std::ostream& os, std::size_t count) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(unbound_checks_failed(os, count))
+    }
+
+    inline virtual void end_run(std::ostream& os, std::size_t test_count, std::size_t group_count,
+        std::size_t passed_count, std::size_t failed_count, double ns) NANO_TEST_OVERRIDE {
+      NANO_TEST_TEE_FORWARD(end_run(os, test_count, group_count, passed_count, failed_count, ns))
+    }
+
+  private:
+    reporter* m_reporters[max_reporters];
+    std::size_t m_count;
+  };
+
+#undef NANO_TEST_TEE_FORWARD
+
+  /// Base of the reporters writing a report file while the tests run, set with --report-file.
+  ///
+  /// The events of a test are collected per output stream, which is distinct for every worker thread,
+  /// and the test is formatted into the buffered file as soon as it ends. The file is flushed after every
+  /// test, so a crash keeps the tests that ended. Nothing is left to do once the run ends but writing the
+  /// totals. A shard process formats its tests into a stream given to redirect and sends them to the
+  /// runner, which appends them to the file.
+  class file_reporter : public reporter {
+  public:
+    enum { buffer_size = 64 * 1024 };
+
+    inline file_reporter()
+        : m_out(&m_file)
+        , m_written(0) {}
+
+    virtual ~file_reporter() NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+    inline bool open(const char* path) {
+      m_buffer.resize(buffer_size);
+      m_file.rdbuf()->pubsetbuf(&m_buffer[0], static_cast<std::streamsize>(m_buffer.size()));
+      m_file.open(path, std::ios::binary | std::ios::trunc);
+      m_out = &m_file;
+      m_written = 0;
+      m_pending.clear();
+      return m_file.is_open();
+    }
+
+    inline void close() {
+      if (m_file.is_open()) {
+        m_file.close();
+      }
+    }
+
+    /// Writes the tests to os instead of the file, without separators, one test per flush of os.
+    inline void redirect(std::ostream* os) { m_out = os ? os : &m_file; }
+
+    /// Appends a test formatted by a shard process.
+    inline void append(const char* data, std::size_t size) {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      emit(data, size);
+    }
+
+    inline virtual void begin_run(std::ostream&, std::size_t, std::size_t) NANO_TEST_OVERRIDE {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      write_begin(*m_out);
+    }
+
+    inline virtual void begin_test(std::ostream& os, const char* group, const test_item& t) NANO_TEST_OVERRIDE {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      test_report& r = m_pending[&os];
+      r = test_report();
+      r.group = group;
+      r.item = &t;
+    }
+
+    inline virtual void check_failed(
+        std::ostream& os, const char* expr, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      add_failure(os, expr, file, line);
+    }
+
+    inline virtual void exception_check_failed(std::ostream& os, const char* expected, const char* got,
+        const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      add_failure(os, std::string(got) + ", expected " + expected, file, line);
+    }
+
+    inline virtual void assert_failed(std::ostream& os, const char* what) NANO_TEST_OVERRIDE {
+      add_failure(os, what, "", 0);
+    }
+
+    inline virtual void performance_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, double measured_ns, double limit_ns) NANO_TEST_OVERRIDE {
+      std::ostringstream message;
+      message << expr << ", median ";
+      detail::print_ns(message, measured_ns);
+      message << " over ";
+      detail::print_ns(message, limit_ns);
+      add_failure(os, message.str(), file, line);
+    }
+
+    inline virtual void range_check_failed(std::ostream& os, const char* expr, const char* file, std::size_t line,
+        std::size_t index, const std::string& a, const std::string& b) NANO_TEST_OVERRIDE {
+      std::ostringstream message;
+      message << expr << ", mismatch [" << index << "] " << a << " vs " << b;
+      add_failure(os, message.str(), file, line);
+    }
+
+    inline virtual void golden_check_failed(std::ostream& os, const char* expr, const char* path,
+        const std::string& error, const char* file, std::size_t line) NANO_TEST_OVERRIDE {
+      add_failure(os, std::string(expr) + ", golden " + path + ": " + error, file, line);
+    }
+
+    inline virtual void range_error_check_failed(std::ostream& os, const char* expr, const char* file,
+        std::size_t line, std::size_t size, const range_error& e, const std::string& a,
+        const std::string& b) NANO_TEST_OVERRIDE {
+      std::ostringstream message;
+      message << expr << ", " << e.mismatch_count << " of " << size << " elements, worst [" << e.worst_index << "] "
+              << a << " vs " << b;
+      add_failure(os, message.str(), file, line);
+    }
+
+    inline virtual void benchmark(std::ostream& os, const benchmark_result& b) NANO_TEST_OVERRIDE {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      m_pending[&os].median_ns = b.median_ns;
+    }
+
+    inline virtual void end_test(std::ostream& os, const char* group, const test_item& t, bool passed,
+        std::size_t checks, std::size_t failed_checks, double ns) NANO_TEST_OVERRIDE {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      test_report& r = m_pending[&os];
+      r.group = group;
+      r.item = &t;
+      r.status = passed ? test_report::passed : test_report::failed;
+      r.checks = checks;
+      r.failed_checks = failed_checks;
+      r.ns = ns;
+      write(r);
+      m_pending.erase(&os);
+    }
+
+    inline virtual void test_crashed(
+        std::ostream&, const char* group, const test_item& t, const char* reason, int code) NANO_TEST_OVERRIDE {
+      std::ostringstream message;
+      message << reason << " " << code;
+
+      test_report r;
+      r.group = group;
+      r.item = &t;
+      r.status = test_report::crashed;
+      r.error = message.str();
+
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      write(r);
+    }
+
+    inline virtual void test_timed_out(
+        std::ostream& os, const char* group, const test_item& t, double ns) NANO_TEST_OVERRIDE {
+      std::ostringstream message;
+      message << "Test timed out after ";
+      detail::print_ns(message, ns);
+
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      // The failures of the test running on this thread are kept, they are the last words before it hung.
+      test_report r = m_pending[&os];
+      m_pending.erase(&os);
+      r.group = group;
+      r.item = &t;
+      r.status = test_report::timed_out;
+      r.ns = ns;
+      r.error = message.str();
+      write(r);
+    }
+
+    inline virtual void end_run(std::ostream&, std::size_t, std::size_t, std::size_t passed_count,
+        std::size_t failed_count, double ns) NANO_TEST_OVERRIDE {
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      write_end(*m_out, passed_count, failed_count, ns);
+      m_out->flush();
+    }
+
+  protected:
+    struct failure {
+      std::string message;
+      const char* file;
+      std::size_t line;
+    };
+
+    struct test_report {
+      enum status_type { passed, failed, crashed, timed_out };
+
+      inline test_report()
+          : group("")
+          , item(NANO_TEST_NULLPTR)
+          , status(passed)
+          , checks(0)
+          , failed_checks(0)
+          , ns(0)
+          , median_ns(-1) {}
+
+      const char* group;
+      const test_item* item;
+      status_type status;
+      std::size_t checks;
+      std::size_t failed_checks;
+      double ns;
+
+      /// Median of a benchmark, negative for a test.
+      double median_ns;
+      std::vector<failure> failures;
+
+      /// Reason of a crash or of a timeout.
+      std::string error;
+    };
+
+    virtual void write_begin(std::ostream& os) = 0;
+    virtual void write_test(std::ostream& os, const test_report& r) = 0;
+    virtual void write_end(std::ostream& os, std::size_t passed_count, std::size_t failed_count, double ns) = 0;
+
+    /// Written between two tests in the file.
+    virtual const char* separator() const { return ""; }
+
+  private:
+    std::ofstream m_file;
+    std::vector<char> m_buffer;
+    std::ostream* m_out;
+    std::size_t m_written;
+    std::map<const std::ostream*, test_report> m_pending;
+#ifdef NANO_TEST_HAS_THREADS
+    std::mutex m_mutex;
+#endif
+
+    inline void add_failure(std::ostream& os, const std::string& message, const char* file, std::size_t line) {
+      failure f;
+      f.message = message;
+      f.file = file;
+      f.line = line;
+
+#ifdef NANO_TEST_HAS_THREADS
+      std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+      m_pending[&os].failures.push_back(f);
+    }
+
+    inline void write(const test_report& r) {
+      std::ostringstream test;
+      write_test(test, r);
+      const std::string text = test.str();
+
+      if (m_out != &m_file) {
+        m_out->write(text.data(), static_cast<std::streamsize>(text.size()));
+        m_out->flush();
+        return;
+      }
+      emit(text.data(), text.size());
+    }
+
+    inline void emit(const char* data, std::size_t size) {
+      if (m_written++) {
+        *m_out << separator();
+      }
+      m_out->write(data, static_cast<std::streamsize>(size));
+      m_out->flush();
+    }
+  };
+
+  /// Writes a JUnit XML report, one testcase per test with the group as its class name.
+  /// The totals of the testsuite are written over a blank reserved in its start tag once the run ends.
+  class junit_reporter : public file_reporter {
+  public:
+    virtual ~junit_reporter() NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+  protected:
+    enum { totals_width = 96 };
+
+    inline virtual void write_begin(std::ostream& os) NANO_TEST_OVERRIDE {
+      os << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n  <testsuite name=\"nano-test\" ";
+      m_totals = os.tellp();
+      os << std::string(totals_width, ' ') << ">\n";
+    }
+
+    inline virtual void write_test(std::ostream& os, const test_report& r) NANO_TEST_OVERRIDE {
+      os << "    <testcase classname=\"";
+      detail::write_xml_string(os, r.group);
+      os << "\" name=\"";
+      detail::write_xml_string(os, r.item->name);
+      os << "\" time=\"";
+      write_seconds(os, r.ns);
+      os << "\">\n";
+
+      for (std::size_t i = 0; i < r.failures.size(); i++) {
+        const failure& f = r.failures[i];
+        os << "      <failure message=\"";
+        detail::write_xml_string(os, f.message.c_str());
+        os << "\">";
+        if (f.line) {
+          detail::write_xml_string(os, f.file);
+          os << ":" << f.line;
+        }
+        os << "</failure>\n";
+      }
+
+      if (!r.error.empty()) {
+        os << "      <error message=\"";
+        detail::write_xml_string(os, r.error.c_str());
+        os << "\"/>\n";
+      }
+
+      os << "    </testcase>\n";
+    }
+
+    inline virtual void write_end(
+        std::ostream& os, std::size_t passed_count, std::size_t failed_count, double ns) NANO_TEST_OVERRIDE {
+      os << "  </testsuite>\n</testsuites>\n";
+
+      const std::streampos end = os.tellp();
+      if (m_totals != std::streampos(-1) && end != std::streampos(-1)) {
+        std::ostringstream totals;
+        totals << "tests=\"" << passed_count + failed_count << "\" failures=\"" << failed_count << "\" time=\"";
+        write_seconds(totals, ns);
+        totals << "\"";
+
+        os.seekp(m_totals);
+        os << totals.str().substr(0, totals_width);
+        os.seekp(end);
+      }
+    }
+
+  private:
+    std::streampos m_totals;
+
+    inline static void write_seconds(std::ostream& os, double ns) {
+      detail::message_buffer<64> text(os);
+      text.append_fixed(1e-9 * ns, 6);
+      text.flush();
+    }
+  };
+
+  /// Writes a JSON report: {"tests": [...], "passed": n, "failed": n, "duration_ns": n}.
+  class json_reporter : public file_reporter {
+  public:
+    virtual ~json_reporter() NANO_TEST_OVERRIDE NANO_TEST_DEFAULT()
+
+  protected:
+    inline virtual void write_begin(std::ostream& os) NANO_TEST_OVERRIDE { os << "{\"tests\":[\n"; }
+
+    inline virtual void write_test(std::ostream& os, const test_report& r) NANO_TEST_OVERRIDE {
+      static const char* const statuses[] = { "passed", "failed", "crashed", "timed_out" };
+
+      os << "{\"group\":";
+      detail::write_json_string(os, r.group);
+      os << ",\"name\":";
+      detail::write_json_string(os, r.item->name);
+      os << ",\"status\":\"" << statuses[r.status] << "\",\"duration_ns\":" << nanoseconds(r.ns)
+         << ",\"checks\":" << r.checks << ",\"failed_checks\":" << r.failed_checks;
+
+      if (r.median_ns >= 0) {
+        os << ",\"median_ns\":" << nanoseconds(r.median_ns);
+      }
+
+      if (!r.error.empty()) {
+        os << ",\"error\":";
+        detail::write_json_string(os, r.error.c_str());
+      }
+
+      os << ",\"failures\":[";
+      for (std::size_t i = 0; i < r.failures.size(); i++) {
+        const failure& f = r.failures[i];
+        os << (i ? "," : "") << "{\"message\":";
+        detail::write_json_string(os, f.message.c_str());
+        os << ",\"file\":";
+        detail::write_json_string(os, f.file);
+        os << ",\"line\":" << f.line << "}";
+      }
+      os << "]}";
+    }
+
+    inline virtual void write_end(
+        std::ostream& os, std::size_t passed_count, std::size_t failed_count, double ns) NANO_TEST_OVERRIDE {
+      os << "\n],\"passed\":" << passed_count << ",\"failed\":" << failed_count << ",\"duration_ns\":"
+         << nanoseconds(ns) << "}\n";
+    }
+
+    inline virtual const char* separator() const NANO_TEST_OVERRIDE { return ",\n"; }
+
+  private:
+    inline static unsigned long long nanoseconds(double ns) { return static_cast<unsigned long long>(ns + 0.5); }
+  };
+
+  // MARK: - Test check result -
+
+  struct check_result {
+    inline check_result()
+        : group(NANO_TEST_NULLPTR)
+        , item(NANO_TEST_NULLPTR)
+        , expr(NANO_TEST_NULLPTR)
+        , file(NANO_TEST_NULLPTR)
+        , line(0)
+        , end_time(0)
+        , success(false) {}
+
+    inline check_result(const char* _group, const test_item* _item, const char* _expr, const char* _file,
+        std::size_t _line, std::size_t _end_time, bool _success)
+        : group(_group)
+        , item(_item)
+        , expr(_expr)
+        , file(_file)
+        , line(_line)
+        , end_time(_end_time)
+        , success(_success) {}
+
+    const char* group;
+    const test_item* item;
+    const char* expr;
+
+    const char* file;
+    std::size_t line;
+
+    /// Time of the check since the start of its test in us, 0 with --no-check-time.
+    std::size_t end_time;
+    bool success;
+    char reserved[7];
+  };
+
+  /// Number of passing checks of an EXPECT call site.
+  struct check_site {
+    inline check_site()
+        : expr(NANO_TEST_NULLPTR)
+        , file(NANO_TEST_NULLPTR)
+        , line(0)
+        , passed(0) {}
+
+    inline check_site(const char* _expr, const char* _file, std::size_t _line)
+        : expr(_expr)
+        , file(_file)
+        , line(_line)
+        , passed(0) {}
+
+    const char* expr;
+    const char* file;
+    std::size_t line;
+    std::size_t passed;
+  };
+
+  /// Compact recording of the checks, filled by run(argc, argv, summary).
+  /// Failures are kept in full detail while passing checks are only counted per call site,
+  /// so the memory used does not grow with the number of checks.
+  struct check_summary {
+    std::vector<check_result> failures;
+
+    /// Call sites with at least one passing check, ordered by file and line.
+    std::vector<check_site> sites;
+  };
+
+  namespace detail {
+    /// Orders check results by group name, then by position of the test in its group.
+    struct check_result_order {
+      inline bool operator()(const check_result& a, const check_result& b) const {
+        const int c = std::strcmp(a.group, b.group);
+        return c == 0 ? std::less<const test_item*>()(a.item, b.item) : c < 0;
+      }
+    };
+
+#ifdef NANO_TEST_HAS_THREADS
+    /// Check counter shared by the thread running a test and the threads it spawns.
+    ///
+    /// The thread that last assigned the counter owns it, the runner assigns it when a test starts. Its
+    /// increments are plain additions, so a passing check on the test thread costs no atomic operation.
+    /// The other threads, bound with a test_scope or not, add to a relaxed atomic. The count is the sum of
+    /// both and is only read once the test ends.
+    class check_counter {
+    public:
+      inline check_counter(std::size_t value = 0)
+          : m_owner(current_thread_token())
+          , m_value(value)
+          , m_shared(0) {}
+
+      inline check_counter& operator=(std::size_t value) {
+        m_owner = current_thread_token();
+        m_value = value;
+        m_shared.store(0, std::memory_order_relaxed);
+        return *this;
+      }
+
+      inline operator std::size_t() const { return m_value + m_shared.load(std::memory_order_relaxed); }
+
+      inline std::size_t operator++(int) {
+        if (NANO_TEST_LIKELY(current_thread_token() == m_owner)) {
+          return m_value++;
+        }
+        return m_shared.fetch_add(1, std::memory_order_relaxed);
+      }
+
+    private:
+      const void* m_owner;
+      std::size_t m_value;
+      std::atomic<std::size_t> m_shared;
+    };
+
+    typedef std::atomic<bool> check_flag;
+#else
+    typedef std::size_t check_counter;
+    typedef bool check_flag;
+#endif
+
+#ifdef NANO_TEST_HAS_THREADS
+    typedef std::atomic<std::size_t> check_site_id;
+#else
+    typedef std::size_t check_site_id;
+#endif
+
+    /// Interns EXPECT call sites into small ids, starting at 1.
+    /// Every call site caches its id in a static check_site_id, so the lookup only happens once per site.
+    class check_site_registry {
+    public:
+      static inline check_site_registry& get() {
+        static check_site_registry* r = new check_site_registry();
+        return *r;
+      }
+
+      inline std::size_t intern(const char* expr, const char* file, std::size_t line) {
+#ifdef NANO_TEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+        const check_site key(expr, file, line);
+        std::map<check_site, std::size_t, site_less>::const_iterator it = m_ids.find(key);
+        if (it != m_ids.end()) {
+          return it->second;
+        }
+
+        m_sites.push_back(key);
+        m_ids.insert(std::make_pair(key, m_sites.size()));
+        return m_sites.size();
+      }
+
+      inline check_site site(std::size_t id) {
+#ifdef NANO_TEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+        return m_sites[id - 1];
+      }
+
+      struct site_less {
+        inline bool operator()(const check_site& a, const check_site& b) const {
+          const int f = std::strcmp(a.file, b.file);
+          if (f != 0) {
+            return f < 0;
+          }
+
+          return a.line != b.line ? a.line < b.line : std::strcmp(a.expr, b.expr) < 0;
+        }
+      };
+
+    private:
+#ifdef NANO_TEST_HAS_THREADS
+      std::mutex m_mutex;
+#endif
+      std::map<check_site, std::size_t, site_less> m_ids;
+      std::vector<check_site> m_sites;
+    };
+
+    /// Fixed size block of check results, never moved once allocated.
+    struct check_chunk {
+      enum { capacity = 256 };
+
+      inline check_chunk()
+          : next(NANO_TEST_NULLPTR)
+          , size(0) {}
+
+      check_chunk* next;
+      std::size_t size;
+      check_result data[capacity];
+    };
+
+    /// Append-only list of chunks written by a single thread.
+    class check_buffer {
+    public:
+      inline check_buffer()
+          : next(NANO_TEST_NULLPTR)
+          , m_head(NANO_TEST_NULLPTR)
+          , m_tail(NANO_TEST_NULLPTR) {}
+
+      inline ~check_buffer() { clear(); }
+
+      inline void push(const check_result& r) {
+        if (!m_tail || m_tail->size == check_chunk::capacity) {
+          grow();
+        }
+
+        m_tail->data[m_tail->size++] = r;
+      }
+
+      inline bool empty() const { return !m_head || !m_head->size; }
+
+      inline void count_pass(std::size_t site, std::size_t count) {
+        if (site >= m_site_passes.size()) {
+          m_site_passes.resize(site + 1, 0);
+        }
+        m_site_passes[site] += count;
+      }
+
+      /// Adds the passing checks per site id to counts and resets them.
+      inline void take_site_passes(std::vector<std::size_t>& counts) {
+        if (m_site_passes.size() > counts.size()) {
+          counts.resize(m_site_passes.size(), 0);
+        }
+
+        for (std::size_t i = 0; i < m_site_passes.size(); i++) {
+          counts[i] += m_site_passes[i];
+        }
+        m_site_passes.clear();
+      }
+
+      inline void copy_to(std::vector<check_result>& results) const {
+        for (const check_chunk* c = m_head; c; c = c->next) {
+          results.insert(results.end(), c->data, c->data + c->size);
+        }
+      }
+
+      inline void clear() {
+        while (m_head) {
+          check_chunk* c = m_head;
+          m_head = c->next;
+          delete c;
+        }
+
+        m_tail = NANO_TEST_NULLPTR;
+      }
+
+      /// Next buffer in the recorder list.
+      check_buffer* next;
+
+    private:
+      check_chunk* m_head;
+      check_chunk* m_tail;
+
+      /// Passing checks per site id, only used in compact mode.
+      std::vector<std::size_t> m_site_passes;
+
+      inline void grow() {
+        check_chunk* c = new check_chunk();
+        if (m_tail) {
+          m_tail->next = c;
+        }
+        else {
+          m_head = c;
+        }
+
+        m_tail = c;
+      }
+
+      check_buffer(const check_buffer&);
+      check_buffer& operator=(const check_buffer&);
+    };
+
+    /// Records check results from any thread without locking.
+    ///
+    /// Every thread appends to its own check_buffer, which is published once in a lock-free list.
+    /// Buffers are only read by merge(), after all the writing threads are done with the test run.
+    class check_recorder {
+    public:
+      /// In compact mode passing checks are counted per call site instead of being recorded.
+      enum mode_type { full, compact };
+
+#ifdef NANO_TEST_HAS_THREADS
+      inline check_recorder()
+          : m_mode(full)
+          , m_buffers(NANO_TEST_NULLPTR)
+          , m_id(next_id()) {}
+
+      inline ~check_recorder() {
+        check_buffer* b = m_buffers.load();
+        while (b) {
+          check_buffer* next = b->next;
+          delete b;
+          b = next;
+        }
+      }
+
+      inline void push(const check_result& r) { local().push(r); }
+      inline void count_pass(std::size_t site, std::size_t count = 1) { local().count_pass(site, count); }
+#else
+      inline check_recorder()
+          : m_mode(full) {}
+
+      inline void push(const check_result& r) { m_buffer.push(r); }
+      inline void count_pass(std::size_t site, std::size_t count = 1) { m_buffer.count_pass(site, count); }
+#endif
+
+      inline mode_type mode() const { return m_mode; }
+      inline void set_mode(mode_type m) { m_mode = m; }
+
+      /// Adds the passing checks per site id of all threads to counts and resets them.
+      inline void take_site_passes(std::vector<std::size_t>& counts) {
+#ifdef NANO_TEST_HAS_THREADS
+        for (check_buffer* b = m_buffers.load(); b; b = b->next) {
+          b->take_site_passes(counts);
+        }
+#else
+        m_buffer.take_site_passes(counts);
+#endif
+      }
+
+      /// Appends the passing checks per call site to sites, ordered by file and line, and resets them.
+      inline void merge_sites(std::vector<check_site>& sites) {
+        std::vector<std::size_t> counts;
+        take_site_passes(counts);
+
+        const std::size_t offset = sites.size();
+        for (std::size_t id = 1; id < counts.size(); id++) {
+          if (counts[id]) {
+            sites.push_back(check_site_registry::get().site(id));
+            sites.back().passed = counts[id];
+          }
+        }
+
+        std::sort(sites.begin() + static_cast<std::ptrdiff_t>(offset), sites.end(), check_site_registry::site_less());
+      }
+
+      /// Appends all the recorded results to the given vector in registration order and clears the recorder.
+      inline void merge(std::vector<check_result>& results) {
+        const std::size_t offset = results.size();
+
+#ifdef NANO_TEST_HAS_THREADS
+        for (check_buffer* b = m_buffers.load(); b; b = b->next) {
+          if (!b->empty()) {
+            b->copy_to(results);
+            b->clear();
+          }
+        }
+#else
+        m_buffer.copy_to(results);
+        m_buffer.clear();
+#endif
+
+        // Results of a serial run are already in order.
+        for (std::size_t i = offset + 1; i < results.size(); i++) {
+          if (check_result_order()(results[i], results[i - 1])) {
+            std::stable_sort(
+                results.begin() + static_cast<std::ptrdiff_t>(offset), results.end(), check_result_order());
+            break;
+          }
+        }
+      }
+
+      inline void clear() {
+        std::vector<std::size_t> counts;
+        take_site_passes(counts);
+
+#ifdef NANO_TEST_HAS_THREADS
+        for (check_buffer* b = m_buffers.load(); b; b = b->next) {
+          b->clear();
+        }
+#else
+        m_buffer.clear();
+#endif
+      }
+
+    private:
+      mode_type m_mode;
+
+#ifdef NANO_TEST_HAS_THREADS
+      std::atomic<check_buffer*> m_buffers;
+      std::size_t m_id;
+
+      struct local_buffer {
+        check_buffer* buffer;
+        std::size_t id;
+      };
+
+      inline check_buffer& local() {
+        static thread_local local_buffer lb = { NANO_TEST_NULLPTR, 0 };
+        if (lb.id != m_id) {
+          lb.buffer = new check_buffer();
+          lb.id = m_id;
+
+          check_buffer* head = m_buffers.load(std::memory_order_relaxed);
+          do {
+            lb.buffer->next = head;
+          } while (!m_buffers.compare_exchange_weak(head, lb.buffer, std::memory_order_release));
+        }
+
+        return *lb.buffer;
+      }
+
+      static inline std::size_t next_id() {
+        static std::atomic<std::size_t> id(0);
+        return ++id;
+      }
+#else
+      check_buffer m_buffer;
+#endif
+
+      check_recorder(const check_recorder&);
+      check_recorder& operator=(const check_recorder&);
+    };
+  } // namespace detail
+
+  // MARK: - Range comparison -
+
+  struct comp_eq;
+
+  namespace detail {
+    /// Index of the first element of a and b for which Comp is false, size when there is none.
+    template <typename Comp, typename T1, typename T2>
+    struct scalar_kernel {
+      static inline std::size_t find_mismatch(const T1* a, const T2* b, std::size_t size) {
+        for (std::size_t i = 0; i < size; i++) {
+          if (!Comp()(a[i], b[i])) {
+            return i;
+          }
+        }
+
+        return size;
+      }
+    };
+
+    template <typename Comp, typename T1, typename T2>
+    struct range_kernel : scalar_kernel<Comp, T1, T2> {};
+
+#if defined(NANO_TEST_HAS_SSE2) || defined(NANO_TEST_HAS_NEON)
+    inline unsigned int count_trailing_zeros(unsigned int mask) {
+  #ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      return static_cast<unsigned int>(index);
+  #else
+      return static_cast<unsigned int>(__builtin_ctz(mask));
+  #endif
+    }
+
+    template <typename T>
+    inline std::size_t find_scalar_mismatch(const T* a, const T* b, std::size_t begin, std::size_t size) {
+      for (std::size_t i = begin; i < size; i++) {
+        if (!(a[i] == b[i])) {
+          return i;
+        }
+      }
+
+      return size;
+    }
+#endif
+
+#ifdef NANO_TEST_HAS_SSE2
+    inline std::size_t find_byte_mismatch_sse2(const unsigned char* a, const unsigned char* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 16 <= size; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (mask != 0xFFFFu) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    inline std::size_t find_float_mismatch_sse2(const float* a, const float* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 4 <= size; i += 4) {
+        const unsigned int mask
+            = static_cast<unsigned int>(_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+        if (mask != 0xFu) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    inline std::size_t find_double_mismatch_sse2(const double* a, const double* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 2 <= size; i += 2) {
+        const unsigned int mask
+            = static_cast<unsigned int>(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))));
+        if (mask != 0x3u) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+#endif // NANO_TEST_HAS_SSE2
+
+#if defined(NANO_TEST_HAS_AVX2) || defined(NANO_TEST_HAS_AVX2_DISPATCH)
+    inline bool has_avx2() {
+  #ifdef NANO_TEST_HAS_AVX2
+      return true;
+  #else
+      static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+      return supported;
+  #endif
+    }
+
+    NANO_TEST_AVX2_TARGET inline std::size_t find_byte_mismatch_avx2(
+        const unsigned char* a, const unsigned char* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 32 <= size; i += 32) {
+        const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (mask != 0xFFFFFFFFu) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    NANO_TEST_AVX2_TARGET inline std::size_t find_float_mismatch_avx2(
+        const float* a, const float* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 8 <= size; i += 8) {
+        const __m256 eq = _mm256_cmp_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _CMP_EQ_OQ);
+        const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(eq));
+        if (mask != 0xFFu) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    NANO_TEST_AVX2_TARGET inline std::size_t find_double_mismatch_avx2(
+        const double* a, const double* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 4 <= size; i += 4) {
+        const __m256d eq = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_EQ_OQ);
+        const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_pd(eq));
+        if (mask != 0xFu) {
+          return i + count_trailing_zeros(~mask);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+#endif // NANO_TEST_HAS_AVX2 || NANO_TEST_HAS_AVX2_DISPATCH
+
+#ifdef NANO_TEST_HAS_NEON
+    // The vectors only tell whether a block differs, the index is found by the scalar scan of that block.
+    inline std::size_t find_byte_mismatch_neon(const unsigned char* a, const unsigned char* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 16 <= size; i += 16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0xFF) {
+          return find_scalar_mismatch(a, b, i, i + 16);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    inline std::size_t find_float_mismatch_neon(const float* a, const float* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 4 <= size; i += 4) {
+        if (vminvq_u32(vceqq_f32(vld1q_f32(a + i), vld1q_f32(b + i))) != 0xFFFFFFFFu) {
+          return find_scalar_mismatch(a, b, i, i + 4);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+
+    inline std::size_t find_double_mismatch_neon(const double* a, const double* b, std::size_t size) {
+      std::size_t i = 0;
+      for (; i + 2 <= size; i += 2) {
+        const uint32x4_t eq = vreinterpretq_u32_u64(vceqq_f64(vld1q_f64(a + i), vld1q_f64(b + i)));
+        if (vminvq_u32(eq) != 0xFFFFFFFFu) {
+          return find_scalar_mismatch(a, b, i, i + 2);
+        }
+      }
+
+      return find_scalar_mismatch(a, b, i, size);
+    }
+#endif // NANO_TEST_HAS_NEON
+
+    /// Number of set bits of a lane mask.
+    inline std::size_t count_lanes(unsigned int mask) {
+      mask = mask - ((mask >> 1) & 0x55u);
+      mask = (mask & 0x33u) + ((mask >> 2) & 0x33u);
+      return (mask + (mask >> 4)) & 0x0Fu;
+    }
+
+    /// The tolerance kernels count the elements that fail is_approximately_equal(a[i], b[i], tolerance):
+    /// |a - b| <= tolerance or |a - b| < max(|a|, |b|) * tolerance. NaN never compares equal.
+    template <typename T>
+    inline bool is_close(T a, T b, T tolerance) {
+      const T diff = std::abs(a - b);
+      return diff <= tolerance || diff < std::max(std::abs(a), std::abs(b)) * tolerance;
+    }
+
+    template <typename T>
+    inline std::size_t count_scalar_far(const T* a, const T* b, std::size_t begin, std::size_t size, T tolerance) {
+      std::size_t count = 0;
+      for (std::size_t i = begin; i < size; i++) {
+        count += is_close(a[i], b[i], tolerance) ? 0 : 1;
+      }
+
+      return count;
+    }
+
+#ifdef NANO_TEST_HAS_SSE2
+    inline std::size_t count_float_far_sse2(const float* a, const float* b, std::size_t size, float tolerance) {
+      const __m128 sign = _mm_set1_ps(-0.0f);
+      const __m128 t = _mm_set1_ps(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 4 <= size; i += 4) {
+        const __m128 va = _mm_loadu_ps(a + i);
+        const __m128 vb = _mm_loadu_ps(b + i);
+        const __m128 diff = _mm_andnot_ps(sign, _mm_sub_ps(va, vb));
+        const __m128 scale = _mm_max_ps(_mm_andnot_ps(sign, va), _mm_andnot_ps(sign, vb));
+        const __m128 ok = _mm_or_ps(_mm_cmple_ps(diff, t), _mm_cmplt_ps(diff, _mm_mul_ps(scale, t)));
+        count += count_lanes(~static_cast<unsigned int>(_mm_movemask_ps(ok)) & 0xFu);
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+
+    inline std::size_t count_double_far_sse2(const double* a, const double* b, std::size_t size, double tolerance) {
+      const __m128d sign = _mm_set1_pd(-0.0);
+      const __m128d t = _mm_set1_pd(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 2 <= size; i += 2) {
+        const __m128d va = _mm_loadu_pd(a + i);
+        const __m128d vb = _mm_loadu_pd(b + i);
+        const __m128d diff = _mm_andnot_pd(sign, _mm_sub_pd(va, vb));
+        const __m128d scale = _mm_max_pd(_mm_andnot_pd(sign, va), _mm_andnot_pd(sign, vb));
+        const __m128d ok = _mm_or_pd(_mm_cmple_pd(diff, t), _mm_cmplt_pd(diff, _mm_mul_pd(scale, t)));
+        count += count_lanes(~static_cast<unsigned int>(_mm_movemask_pd(ok)) & 0x3u);
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+#endif // NANO_TEST_HAS_SSE2
+
+#if defined(NANO_TEST_HAS_AVX2) || defined(NANO_TEST_HAS_AVX2_DISPATCH)
+    NANO_TEST_AVX2_TARGET inline std::size_t count_float_far_avx2(
+        const float* a, const float* b, std::size_t size, float tolerance) {
+      const __m256 sign = _mm256_set1_ps(-0.0f);
+      const __m256 t = _mm256_set1_ps(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 8 <= size; i += 8) {
+        const __m256 va = _mm256_loadu_ps(a + i);
+        const __m256 vb = _mm256_loadu_ps(b + i);
+        const __m256 diff = _mm256_andnot_ps(sign, _mm256_sub_ps(va, vb));
+        const __m256 scale = _mm256_max_ps(_mm256_andnot_ps(sign, va), _mm256_andnot_ps(sign, vb));
+        const __m256 ok = _mm256_or_ps(
+            _mm256_cmp_ps(diff, t, _CMP_LE_OQ), _mm256_cmp_ps(diff, _mm256_mul_ps(scale, t), _CMP_LT_OQ));
+        count += count_lanes(~static_cast<unsigned int>(_mm256_movemask_ps(ok)) & 0xFFu);
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+
+    NANO_TEST_AVX2_TARGET inline std::size_t count_double_far_avx2(
+        const double* a, const double* b, std::size_t size, double tolerance) {
+      const __m256d sign = _mm256_set1_pd(-0.0);
+      const __m256d t = _mm256_set1_pd(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 4 <= size; i += 4) {
+        const __m256d va = _mm256_loadu_pd(a + i);
+        const __m256d vb = _mm256_loadu_pd(b + i);
+        const __m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(va, vb));
+        const __m256d scale = _mm256_max_pd(_mm256_andnot_pd(sign, va), _mm256_andnot_pd(sign, vb));
+        const __m256d ok = _mm256_or_pd(
+            _mm256_cmp_pd(diff, t, _CMP_LE_OQ), _mm256_cmp_pd(diff, _mm256_mul_pd(scale, t), _CMP_LT_OQ));
+        count += count_lanes(~static_cast<unsigned int>(_mm256_movemask_pd(ok)) & 0xFu);
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+#endif // NANO_TEST_HAS_AVX2 || NANO_TEST_HAS_AVX2_DISPATCH
+
+#ifdef NANO_TEST_HAS_NEON
+    inline std::size_t count_float_far_neon(const float* a, const float* b, std::size_t size, float tolerance) {
+      const float32x4_t t = vdupq_n_f32(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 4 <= size; i += 4) {
+        const float32x4_t va = vld1q_f32(a + i);
+        const float32x4_t vb = vld1q_f32(b + i);
+        const float32x4_t diff = vabdq_f32(va, vb);
+        const float32x4_t scale = vmaxq_f32(vabsq_f32(va), vabsq_f32(vb));
+        const uint32x4_t ok = vorrq_u32(vcleq_f32(diff, t), vcltq_f32(diff, vmulq_f32(scale, t)));
+        count += 4 - vaddvq_u32(vshrq_n_u32(ok, 31));
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+
+    inline std::size_t count_double_far_neon(const double* a, const double* b, std::size_t size, double tolerance) {
+      const float64x2_t t = vdupq_n_f64(tolerance);
+      std::size_t count = 0;
+      std::size_t i = 0;
+
+      for (; i + 2 <= size; i += 2) {
+        const float64x2_t va = vld1q_f64(a + i);
+        const float64x2_t vb = vld1q_f64(b + i);
+        const float64x2_t diff = vabdq_f64(va, vb);
+        const float64x2_t scale = vmaxq_f64(vabsq_f64(va), vabsq_f64(vb));
+        const uint64x2_t ok = vorrq_u64(vcleq_f64(diff, t), vcltq_f64(diff, vmulq_f64(scale, t)));
+        count += 2 - static_cast<std::size_t>(vaddvq_u64(vshrq_n_u64(ok, 63)));
+      }
+
+      return count + count_scalar_far(a, b, i, size, tolerance);
+    }
+#endif // NANO_TEST_HAS_NEON
+
+    /// Selects the widest kernel supported by the compiler, or by the CPU at runtime for AVX2.
+#if defined(NANO_TEST_HAS_AVX2) || defined(NANO_TEST_HAS_AVX2_DISPATCH)
+  #define NANO_TEST_RANGE_KERNEL(NAME, ...) (has_avx2() ? NAME##_avx2(__VA_ARGS__) : NAME##_sse2(__VA_ARGS__))
+#elif defined(NANO_TEST_HAS_SSE2)
+  #define NANO_TEST_RANGE_KERNEL(NAME, ...) NAME##_sse2(__VA_ARGS__)
+#elif defined(NANO_TEST_HAS_NEON)
+  #define NANO_TEST_RANGE_KERNEL(NAME, ...) NAME##_neon(__VA_ARGS__)
+#endif
+
+    /// Equality of two ranges of the same type.
+    /// Integral values are equal when their bytes are, floating point values use vector compares
+    /// that keep the semantics of == (0.0 == -0.0, NaN != NaN).
+    template <typename T, typename Enable = void>
+    struct equal_kernel : scalar_kernel<comp_eq, T, T> {};
+
+#if !defined(NANO_TEST_CPP_98) && defined(NANO_TEST_RANGE_KERNEL)
+    template <typename T>
+    struct equal_kernel<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+      static inline std::size_t find_mismatch(const T* a, const T* b, std::size_t size) {
+        const std::size_t byte = NANO_TEST_RANGE_KERNEL(find_byte_mismatch, reinterpret_cast<const unsigned char*>(a),
+            reinterpret_cast<const unsigned char*>(b), size * sizeof(T));
+        return byte / sizeof(T);
+      }
+    };
+
+    template <>
+    struct equal_kernel<float> {
+      static inline std::size_t find_mismatch(const float* a, const float* b, std::size_t size) {
+        return NANO_TEST_RANGE_KERNEL(find_float_mismatch, a, b, size);
+      }
+    };
+
+    template <>
+    struct equal_kernel<double> {
+      static inline std::size_t find_mismatch(const double* a, const double* b, std::size_t size) {
+        return NANO_TEST_RANGE_KERNEL(find_double_mismatch, a, b, size);
+      }
+    };
+#endif
+
+    /// Number of elements that are not approximately equal.
+    template <typename T1, typename T2>
+    struct tolerance_kernel {
+      typedef typename float_common_return<T1, T2>::type ftype;
+
+      static inline std::size_t count_mismatches(const T1* a, const T2* b, std::size_t size, ftype tolerance) {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < size; i++) {
+          count += is_close(static_cast<ftype>(a[i]), static_cast<ftype>(b[i]), tolerance) ? 0 : 1;
+        }
+
+        return count;
+      }
+    };
+
+#if !defined(NANO_TEST_CPP_98) && defined(NANO_TEST_RANGE_KERNEL)
+    template <>
+    struct tolerance_kernel<float, float> {
+      static inline std::size_t count_mismatches(const float* a, const float* b, std::size_t size, float tolerance) {
+        return NANO_TEST_RANGE_KERNEL(count_float_far, a, b, size, tolerance);
+      }
+    };
+
+    template <>
+    struct tolerance_kernel<double, double> {
+      static inline std::size_t count_mismatches(
+          const double* a, const double* b, std::size_t size, double tolerance) {
+        return NANO_TEST_RANGE_KERNEL(count_double_far, a, b, size, tolerance);
+      }
+    };
+#endif
+
+    /// Maps the bits of a float to an integer that has the same order, +0 and -0 both map to 0.
+    inline long long ordered_bits(float value) {
+      int bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      return bits < 0 ? -static_cast<long long>(bits & 0x7FFFFFFF) : static_cast<long long>(bits);
+    }
+
+    inline long long ordered_bits(double value) {
+      long long bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      return bits < 0 ? -(bits & 0x7FFFFFFFFFFFFFFFLL) : bits;
+    }
+
+    /// Number of representable values between a and b, the maximum value when one of them is NaN.
+    template <typename T>
+    inline unsigned long long ulp_distance(T a, T b) {
+      if (a != a || b != b) {
+        return std::numeric_limits<unsigned long long>::max();
+      }
+
+      const long long ia = ordered_bits(a);
+      const long long ib = ordered_bits(b);
+      return ia >= ib ? static_cast<unsigned long long>(ia) - static_cast<unsigned long long>(ib)
+                      : static_cast<unsigned long long>(ib) - static_cast<unsigned long long>(ia);
+    }
+
+    /// Number of elements more than max_ulps representable values apart.
+    template <typename T1, typename T2>
+    inline std::size_t count_ulp_mismatches(const T1* a, const T2* b, std::size_t size, unsigned long long max_ulps) {
+      typedef typename float_common_return<T1, T2>::type ftype;
+
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < size; i++) {
+        count += ulp_distance(static_cast<ftype>(a[i]), static_cast<ftype>(b[i])) > max_ulps ? 1 : 0;
+      }
+
+      return count;
+    }
+
+#undef NANO_TEST_RANGE_KERNEL
+
+    template <typename T>
+    struct range_kernel<comp_eq, T, T> : equal_kernel<T> {};
+
+#ifdef NANO_TEST_HAS_THREADS
+  #ifndef NANO_TEST_PARALLEL_RANGE_BYTES
+    /// Ranges of at least this many bytes are compared on the range pool.
+    #define NANO_TEST_PARALLEL_RANGE_BYTES (16u << 20)
+  #endif
+
+  #ifndef NANO_TEST_PARALLEL_RANGE_CHUNK_BYTES
+    /// Bytes of each range handed to a pool thread at once.
+    #define NANO_TEST_PARALLEL_RANGE_CHUNK_BYTES (1u << 20)
+  #endif
+
+    /// Threads shared by every large range comparison, created on first use.
+    /// A caller always works on its own job too, so a busy pool only slows a comparison down.
+    class range_pool {
+    public:
+      /// Never destroyed, the threads are left waiting at exit.
+      static inline range_pool& get() {
+        static range_pool* p = new range_pool();
+        return *p;
+      }
+
+      inline std::size_t size() const { return m_threads.size(); }
+
+      /// Calls fct(ctx) on the calling thread and on up to helpers pool threads.
+      /// Returns once every call returned, helpers that did not start by then are dropped.
+      inline void run(void (*fct)(void*), void* ctx, std::size_t helpers) {
+        std::size_t running = 0;
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          for (std::size_t i = 0; i < std::min(helpers, m_threads.size()); i++) {
+            m_tasks.push_back(task(fct, ctx, &running));
+          }
+        }
+
+        m_wake.notify_all();
+        fct(ctx);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (std::deque<task>::iterator it = m_tasks.begin(); it != m_tasks.end();) {
+          it = it->ctx == ctx ? m_tasks.erase(it) : it + 1;
+        }
+
+        m_done.wait(lock, [&running]() { return running == 0; });
+      }
+
+    private:
+      struct task {
+        inline task(void (*f)(void*), void* c, std::size_t* r)
+            : fct(f)
+            , ctx(c)
+            , running(r) {}
+
+        void (*fct)(void*);
+        void* ctx;
+
+        /// Number of pool threads inside fct(ctx), guarded by m_mutex.
+        std::size_t* running;
+      };
+
+      inline range_pool() {
+        const std::size_t count = std::thread::hardware_concurrency();
+        for (std::size_t i = 1; i < count; i++) {
+          m_threads.push_back(std::thread(&range_pool::loop, this));
+        }
+      }
+
+      inline void loop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+          m_wake.wait(lock, [this]() { return !m_tasks.empty(); });
+
+          const task t = m_tasks.front();
+          m_tasks.pop_front();
+          ++*t.running;
+
+          lock.unlock();
+          t.fct(t.ctx);
+          lock.lock();
+
+          --*t.running;
+          m_done.notify_all();
+        }
+      }
+
+      std::mutex m_mutex;
+      std::condition_variable m_wake;
+      std::condition_variable m_done;
+      std::deque<task> m_tasks;
+      std::vector<std::thread> m_threads;
+    };
+
+    /// Comparison of a range split in chunks that the threads take in increasing order.
+    /// A chunk starting past the first mismatch found so far is never compared,
+    /// and since every earlier chunk still completes, the mismatch reported is the first one.
+    template <typename Comp, typename T1, typename T2>
+    struct parallel_range_job {
+      inline parallel_range_job(const T1* a_, const T2* b_, std::size_t size_, std::size_t chunk_)
+          : a(a_)
+          , b(b_)
+          , size(size_)
+          , chunk(chunk_)
+          , next_chunk(0)
+          , mismatch(size_) {}
+
+      static inline void run(void* ctx) {
+        parallel_range_job& job = *static_cast<parallel_range_job*>(ctx);
+
+        for (;;) {
+          const std::size_t begin = job.next_chunk.fetch_add(1, std::memory_order_relaxed) * job.chunk;
+          if (begin >= job.size || begin >= job.mismatch.load(std::memory_order_relaxed)) {
+            return;
+          }
+
+          const std::size_t count = std::min(job.chunk, job.size - begin);
+          const std::size_t index = range_kernel<Comp, T1, T2>::find_mismatch(job.a + begin, job.b + begin, count);
+          if (index == count) {
+            continue;
+          }
+
+          std::size_t current = job.mismatch.load(std::memory_order_relaxed);
+          while (begin + index < current
+              && !job.mismatch.compare_exchange_weak(current, begin + index, std::memory_order_relaxed)) {
+          }
+        }
+      }
+
+      const T1* a;
+      const T2* b;
+      std::size_t size;
+      std::size_t chunk;
+      std::atomic<std::size_t> next_chunk;
+      std::atomic<std::size_t> mismatch;
+    };
+
+    /// Only plain arithmetic ranges are split, a user Comp or operator== may not be safe to call concurrently.
+    template <typename T1, typename T2>
+    inline bool is_parallel_range(std::size_t size) {
+      static const bool has_threads = std::thread::hardware_concurrency() > 1;
+      return std::is_arithmetic<T1>::value && std::is_arithmetic<T2>::value && has_threads
+          && size >= NANO_TEST_PARALLEL_RANGE_BYTES / std::max(sizeof(T1), sizeof(T2));
+    }
+
+    template <typename Comp, typename T1, typename T2>
+    inline std::size_t parallel_find_mismatch(const T1* a, const T2* b, std::size_t size) {
+      const std::size_t chunk = std::max<std::size_t>(
+          NANO_TEST_PARALLEL_RANGE_CHUNK_BYTES / std::max(sizeof(T1), sizeof(T2)), 1);
+
+      parallel_range_job<Comp, T1, T2> job(a, b, size, chunk);
+      range_pool& pool = range_pool::get();
+      pool.run(&parallel_range_job<Comp, T1, T2>::run, &job, std::min(pool.size(), (size + chunk - 1) / chunk - 1));
+      return job.mismatch.load(std::memory_order_relaxed);
+    }
+#endif // NANO_TEST_HAS_THREADS
+  } // namespace detail
+
+  /// Index of the first element for which Comp(a[i], b[i]) is false, size when the ranges match.
+  /// Ranges of arithmetic values larger than NANO_TEST_PARALLEL_RANGE_BYTES are split over a thread pool.
+  template <typename Comp, typename T1, typename T2>
+  inline std::size_t find_range_mismatch(const T1* a, const T2* b, std::size_t size) {
+#ifdef NANO_TEST_HAS_THREADS
+    if (detail::is_parallel_range<T1, T2>(size)) {
+      return detail::parallel_find_mismatch<Comp>(a, b, size);
+    }
+#endif
+
+    return detail::range_kernel<Comp, T1, T2>::find_mismatch(a, b, size);
+  }
+
+  template <typename Comp, typename T1, typename T2>
+  inline bool compare_range(const T1* a, const T2* b, std::size_t size) {
+    return find_range_mismatch<Comp>(a, b, size) == size;
+  }
+
+#ifdef NANO_TEST_HAS_THREADS
+  // MARK: - Work stealing scheduler -
+
+  namespace detail {
+    /// Job indices owned by a single worker.
+    /// The owner pops from the front while idle workers steal from the back.
+    class work_queue {
+    public:
+      inline void push(std::size_t index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.push_back(index);
+      }
+
+      inline bool pop(std::size_t& index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty()) {
+          return false;
+        }
+
+        index = m_items.front();
+        m_items.pop_front();
+        return true;
+      }
+
+      inline bool steal(std::size_t& index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty()) {
+          return false;
+        }
+
+        index = m_items.back();
+        m_items.pop_back();
+        return true;
+      }
+
+    private:
+      std::mutex m_mutex;
+      std::deque<std::size_t> m_items;
+    };
+
+    /// Distributes job indices [0, job_count) in contiguous blocks over the workers.
+    /// A worker whose queue runs dry steals from the others until every queue is empty.
+    class work_stealing_scheduler {
+    public:
+      inline work_stealing_scheduler(std::size_t worker_count, std::size_t job_count)
+          : m_queues(worker_count) {
+        for (std::size_t i = 0; i < job_count; i++) {
+          m_queues[(i * worker_count) / job_count].push(i);
+        }
+      }
+
+      inline bool next(std::size_t worker, std::size_t& index) {
+        if (m_queues[worker].pop(index)) {
+          return true;
+        }
+
+        for (std::size_t i = 1; i < m_queues.size(); i++) {
+          if (m_queues[(worker + i) % m_queues.size()].steal(index)) {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+    private:
+      std::vector<work_queue> m_queues;
+    };
+  } // namespace detail
+#endif // NANO_TEST_HAS_THREADS
+
+#ifdef NANO_TEST_HAS_FORK
+  // MARK: - Shard protocol -
+
+  namespace detail {
+    /// Header of a record sent by a shard process to the runner, followed by size bytes of payload.
+    struct shard_record {
+      enum record_type { begin_test, end_test, output, check, timing, site, report };
+
+      unsigned int type;
+      unsigned int job;
+      std::size_t size;
+    };
+
+    /// Payload of a check record.
+    /// Both processes share the same image, so string literals are sent as pointers.
+    struct shard_check {
+      const char* expr;
+      const char* file;
+      std::size_t line;
+      std::size_t end_time;
+      bool success;
+      char reserved[7];
+    };
+
+    /// Payload of a site record, the passing checks of a call site in compact mode.
+    struct shard_site {
+      const char* expr;
+      const char* file;
+      std::size_t line;
+      std::size_t passed;
+    };
+
+    /// Payload of a timing record, followed by the samples.
+    struct shard_timing {
+      bool benchmark;
+      char reserved[7];
+    };
+
+    /// Payload of an end_test record.
+    struct shard_end {
+      bool passed;
+      bool should_stop;
+      char reserved[6];
+    };
+
+    inline bool write_shard_record(int fd, unsigned int type, std::size_t job, const void* payload, std::size_t size) {
+      shard_record r;
+      r.type = type;
+      r.job = static_cast<unsigned int>(job);
+      r.size = size;
+      return write_all(fd, &r, sizeof(r)) && write_all(fd, payload, size);
+    }
+  } // namespace detail
+#endif // NANO_TEST_HAS_FORK
+
+  // MARK: - Test filter -
+
+  namespace detail {
+    /// "group.name" of a test, read character by character without building the string.
+    struct full_test_name {
+      inline full_test_name(const std::string& g, const char* n)
+          : group(g.c_str())
+          , name(n)
+          , group_size(g.size())
+          , size(g.size() + 1 + std::strlen(n)) {}
+
+      inline char operator[](std::size_t i) const {
+        return i < group_size ? group[i] : (i == group_size ? '.' : name[i - group_size - 1]);
+      }
+
+      const char* group;
+      const char* name;
+      std::size_t group_size;
+      std::size_t size;
+    };
+
+    /// Matches a glob where '*' is any sequence and '?' any character.
+    /// Backtracks only to the last '*', the cost is linear for the usual single wildcard patterns.
+    inline bool glob_match(const std::string& pattern, const full_test_name& s) {
+      const std::size_t npos = static_cast<std::size_t>(-1);
+      std::size_t p = 0;
+      std::size_t i = 0;
+      std::size_t star = npos;
+      std::size_t mark = 0;
+
+      while (i < s.size) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == s[i])) {
+          p++;
+          i++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*') {
+          star = p++;
+          mark = i;
+        }
+        else if (star != npos) {
+          p = star + 1;
+          i = ++mark;
+        }
+        else {
+          return false;
+        }
+      }
+
+      while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+      }
+
+      return p == pattern.size();
+    }
+
+    /// Selection of --filter and --tags, parsed once before the tests are listed.
+    ///
+    /// The filter follows gtest, "positive[:positive...][-negative[:negative...]]" with globs over "group.name".
+    /// Group names may contain dashes, written "\-" so that they do not start the negative patterns.
+    /// Tags are written in the test description as "[tag]", "~tag" excludes the tests that have it.
+    class test_filter {
+    public:
+      inline void set_patterns(const std::string& filter) {
+        std::size_t dash = 0;
+        while ((dash = filter.find('-', dash)) != std::string::npos && dash > 0 && filter[dash - 1] == '\\') {
+          dash++;
+        }
+
+        split(filter.substr(0, dash), m_positive);
+        m_negative.clear();
+        if (dash != std::string::npos) {
+          split(filter.substr(dash + 1), m_negative);
+        }
+
+        // Characters before the first wildcard, a group that differs from them is skipped as a whole.
+        m_prefixes.clear();
+        for (std::size_t i = 0; i < m_positive.size(); i++) {
+          m_prefixes.push_back(m_positive[i].substr(0, m_positive[i].find_first_of("*?")));
+        }
+      }
+
+      inline void add_tag(const std::string& tag) {
+        if (!tag.empty() && tag[0] == '~') {
+          m_excluded_tags.push_back("[" + tag.substr(1) + "]");
+        }
+        else {
+          m_tags.push_back("[" + tag + "]");
+        }
+      }
+
+      /// False when no test of the group can pass the positive patterns.
+      inline bool may_match_group(const std::string& group) const {
+        if (m_positive.empty()) {
+          return true;
+        }
+
+        for (std::size_t i = 0; i < m_prefixes.size(); i++) {
+          const std::string& prefix = m_prefixes[i];
+          const std::size_t n = std::min(prefix.size(), group.size());
+          if (prefix.compare(0, n, group, 0, n) == 0 && (prefix.size() <= group.size() || prefix[n] == '.')) {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      inline bool matches(const std::string& group, const test_item& t) const {
+        if (!m_tags.empty() || !m_excluded_tags.empty()) {
+          if (!m_tags.empty() && !has_any_tag(t.desc, m_tags)) {
+            return false;
+          }
+
+          if (has_any_tag(t.desc, m_excluded_tags)) {
+            return false;
+          }
+        }
+
+        if (m_positive.empty() && m_negative.empty()) {
+          return true;
+        }
+
+        const full_test_name name(group, t.name);
+        return (m_positive.empty() || any_match(m_positive, name)) && !any_match(m_negative, name);
+      }
+
+    private:
+      std::vector<std::string> m_positive;
+      std::vector<std::string> m_negative;
+      std::vector<std::string> m_prefixes;
+      std::vector<std::string> m_tags;
+      std::vector<std::string> m_excluded_tags;
+
+      /// Splits at ':' and unescapes "\-".
+      static inline void split(const std::string& patterns, std::vector<std::string>& out) {
+        out.clear();
+        std::size_t begin = 0;
+        while (begin <= patterns.size()) {
+          const std::size_t end = std::min(patterns.find(':', begin), patterns.size());
+          if (end > begin) {
+            std::string pattern = patterns.substr(begin, end - begin);
+            for (std::size_t i = pattern.find("\\-"); i != std::string::npos; i = pattern.find("\\-", i + 1)) {
+              pattern.erase(i, 1);
+            }
+            out.push_back(pattern);
+          }
+          begin = end + 1;
+        }
+      }
+
+      static inline bool any_match(const std::vector<std::string>& patterns, const full_test_name& name) {
+        for (std::size_t i = 0; i < patterns.size(); i++) {
+          if (glob_match(patterns[i], name)) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      static inline bool has_any_tag(const char* desc, const std::vector<std::string>& tags) {
+        for (std::size_t i = 0; i < tags.size(); i++) {
+          if (std::strstr(desc, tags[i].c_str())) {
+            return true;
+          }
+        }
+        return false;
+      }
+    };
+  } // namespace detail
+
+  // MARK: - Timeouts -
+
+  namespace detail {
+    /// Timeout of a test in seconds, from its NANO_TEST_TIMEOUT flag or else the --timeout default, 0 for none.
+    inline double test_timeout(const test_item& t, double default_timeout) {
+      const long seconds = t.flags >> NANO_TEST_TIMEOUT_SHIFT;
+      return seconds > 0 ? static_cast<double>(seconds) : default_timeout;
+    }
+
+#ifdef NANO_TEST_HAS_THREADS
+    /// Thread that calls a handler when a test runs past its deadline.
+    ///
+    /// Every runner thread owns a slot that it arms before a test and disarms after it. Arming only wakes
+    /// the watchdog when the new deadline is earlier than the one it sleeps until, so with the increasing
+    /// deadlines of consecutive tests it wakes up about once per timeout instead of once per test.
+    class watchdog {
+    public:
+      typedef std::chrono::steady_clock clock_type;
+
+      /// Receives the context given to the constructor, then the data, test and timeout in seconds given to arm.
+      typedef void (*handler_type)(void*, void*, const char*, const test_item&, double);
+
+      inline watchdog(std::size_t slot_count, handler_type handler, void* context)
+          : m_slots(slot_count)
+          , m_handler(handler)
+          , m_context(context)
+          , m_wake_time(clock_type::time_point::max())
+          , m_stop(false) {
+        m_thread = std::thread(&watchdog::run, this);
+      }
+
+      inline ~watchdog() {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+      }
+
+      inline void arm(std::size_t index, double seconds, void* data, const char* group, const test_item& item) {
+        const clock_type::time_point deadline = clock_type::now()
+            + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot& s = m_slots[index];
+        s.deadline = deadline;
+        s.seconds = seconds;
+        s.data = data;
+        s.group = group;
+        s.item = &item;
+        s.armed = true;
+
+        if (deadline < m_wake_time) {
+          m_wake_time = deadline;
+          m_wake.notify_one();
+        }
+      }
+
+      inline void disarm(std::size_t index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots[index].armed = false;
+      }
+
+      /// Arms a slot for the lifetime of the scope, does nothing without a watchdog or a timeout.
+      class scope {
+      public:
+        inline scope(
+            watchdog* w, std::size_t index, double seconds, void* data, const char* group, const test_item& item)
+            : m_watchdog(seconds > 0 ? w : NANO_TEST_NULLPTR)
+            , m_index(index) {
+          if (m_watchdog) {
+            m_watchdog->arm(index, seconds, data, group, item);
+          }
+        }
+
+        inline ~scope() {
+          if (m_watchdog) {
+            m_watchdog->disarm(m_index);
+          }
+        }
+
+      private:
+        watchdog* m_watchdog;
+        std::size_t m_index;
+
+        scope(const scope&);
+        scope& operator=(const scope&);
+      };
+
+    private:
+      struct slot {
+        inline slot()
+            : seconds(0)
+            , data(NANO_TEST_NULLPTR)
+            , group(NANO_TEST_NULLPTR)
+            , item(NANO_TEST_NULLPTR)
+            , armed(false) {}
+
+        clock_type::time_point deadline;
+        double seconds;
+        void* data;
+
+        /// Test the slot was armed for, recorded so that the handler never reads it from a test that moved on.
+        const char* group;
+        const test_item* item;
+        bool armed;
+      };
+
+      std::vector<slot> m_slots;
+      handler_type m_handler;
+      void* m_context;
+      std::mutex m_mutex;
+      std::condition_variable m_wake;
+      std::thread m_thread;
+
+      /// Deadline the thread sleeps until, max when no slot is armed.
+      clock_type::time_point m_wake_time;
+      bool m_stop;
+
+      inline void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (!m_stop) {
+          const clock_type::time_point now = clock_type::now();
+          slot* expired = NANO_TEST_NULLPTR;
+          m_wake_time = clock_type::time_point::max();
+
+          for (std::size_t i = 0; i < m_slots.size(); i++) {
+            slot& s = m_slots[i];
+            if (!s.armed) {
+              continue;
+            }
+
+            if (s.deadline <= now) {
+              expired = &s;
+              break;
+            }
+
+            m_wake_time = std::min(m_wake_time, s.deadline);
+          }
+
+          if (expired) {
+            // Called with the slots locked: the test cannot disarm and start the next one while its
+            // timeout is reported, a test that ends right at its deadline waits in disarm.
+            expired->armed = false;
+            m_handler(m_context, expired->data, expired->group, *expired->item, expired->seconds);
+          }
+          else if (m_wake_time == clock_type::time_point::max()) {
+            m_wake.wait(lock);
+          }
+          else {
+            m_wake.wait_until(lock, m_wake_time);
+          }
+        }
+      }
+
+      watchdog(const watchdog&);
+      watchdog& operator=(const watchdog&);
+    };
+#endif // NANO_TEST_HAS_THREADS
+  } // namespace detail
+
+  // MARK: - Tests manager -
+
+  class manager {
+  public:
+    struct state {
+      state()
+          : current_item(NANO_TEST_NULLPTR)
+          , passed_count(0)
+          , failed_count(0)
+          , total_tests(0)
+          , check_count(0)
+          , failed_check_count(0)
+          , recorder(NANO_TEST_NULLPTR)
+          , output(NANO_TEST_NULLPTR)
+          , reporter(NANO_TEST_NULLPTR)
+          , timings(NANO_TEST_NULLPTR)
+          , journal(NANO_TEST_NULLPTR)
+          , journal_test(0)
+          , timeout(0)
+#ifdef NANO_TEST_HAS_THREADS
+          , watchdog(NANO_TEST_NULLPTR)
+          , watchdog_slot(0)
+#endif
+          , current_test_failed(false)
+          , should_stop(false)
+          , check_timestamps(true)
+          , update_golden(false)
+
+      {}
+
+      const test_item* current_item;
+      std::size_t passed_count;
+      std::size_t failed_count;
+      std::size_t total_tests;
+      detail::check_counter check_count;
+      detail::check_counter failed_check_count;
+
+      detail::clock::tick_type launch_start_time;
+      detail::clock::tick_type group_start_time;
+      detail::clock::tick_type test_start_time;
+
+      const char* current_group;
+      const char* current_test;
+
+      /// Destination of the check results, null when they are not recorded.
+      detail::check_recorder* recorder;
+
+      /// Stream used for all test output, std::cout when null.
+      /// Worker threads point this to a per-test buffer so that a test's output is never interleaved.
+      std::ostream* output;
+
+      class reporter* reporter;
+
+      /// Destination of the test and benchmark timings, null when they are not collected.
+      std::vector<timing_record>* timings;
+
+      /// Destination of the --journal records, null when there is none.
+      /// journal_test is the begin_test record of the running test, 0 between the tests.
+      detail::journal* journal;
+      unsigned long long journal_test;
+
+      /// Timeout of the tests without a NANO_TEST_TIMEOUT flag in seconds, set by --timeout, 0 for none.
+      double timeout;
+
+#ifdef NANO_TEST_HAS_THREADS
+      /// Watchdog of the in-process runs and the slot of this state, null when no test has a timeout.
+      detail::watchdog* watchdog;
+      std::size_t watchdog_slot;
+#endif
+
+      detail::check_flag current_test_failed;
+      bool should_stop;
+
+      /// Fill check_result::end_time, reading the clock on every recorded check.
+      bool check_timestamps;
+
+      /// Write the golden files instead of comparing with them, set by --update-golden.
+      bool update_golden;
+      char reserved[4];
+
+      inline void add_check(bool success, const char* expr, const char* file, std::size_t line) {
+        if (recorder) {
+          record_check(success, expr, file, line);
+        }
+
+        if (journal && !success) {
+          journal->check_failed(journal_test, expr, file, line);
+        }
+      }
+
+      /// Passing check of an EXPECT macro, site caches the interned id of its call site.
+      inline void check_passed(detail::check_site_id& site, const char* expr, const char* file, std::size_t line) {
+        if (recorder) {
+          record_pass(site, expr, file, line);
+        }
+      }
+
+      NANO_TEST_NOINLINE inline void record_pass(
+          detail::check_site_id& site, const char* expr, const char* file, std::size_t line) {
+        if (recorder->mode() == detail::check_recorder::full) {
+          record_check(true, expr, file, line);
+          return;
+        }
+
+        std::size_t id = site;
+        if (!id) {
+          id = detail::check_site_registry::get().intern(expr, file, line);
+          site = id;
+        }
+        recorder->count_pass(id);
+      }
+
+      NANO_TEST_NOINLINE inline void record_check(bool success, const char* expr, const char* file, std::size_t line) {
+        if (success && recorder->mode() == detail::check_recorder::compact) {
+          recorder->count_pass(detail::check_site_registry::get().intern(expr, file, line));
+          return;
+        }
+
+        const std::size_t end_time = check_timestamps ? static_cast<std::size_t>(test_us()) : 0;
+        recorder->push(check_result(current_group, current_item, expr, file, line, end_time, success));
+      }
+
+      /// Failure path of the EXPECT macros, kept out of line so that a passing check only costs a counter
+      /// increment and a predicted branch.
+      NANO_TEST_COLD inline void expect_failed(const char* expr, const char* file, std::size_t line) {
+        current_test_failed = true;
+        failed_check_count++;
+        add_check(false, expr, file, line);
+        check_failed(expr, file, line);
+      }
+
+      NANO_TEST_COLD inline void range_expect_failed(const char* expr, const char* file, std::size_t line,
+          std::size_t index, const std::string& a, const std::string& b) {
+        current_test_failed = true;
+        failed_check_count++;
+        add_check(false, expr, file, line);
+        reporter->range_check_failed(out(), expr, file, line, index, a, b);
+      }
+
+      NANO_TEST_COLD inline void range_error_expect_failed(const char* expr, const char* file, std::size_t line,
+          std::size_t size, const range_error& e, const std::string& a, const std::string& b) {
+        current_test_failed = true;
+        failed_check_count++;
+        add_check(false, expr, file, line);
+        reporter->range_error_check_failed(out(), expr, file, line, size, e, a, b);
+      }
+
+      NANO_TEST_COLD inline void golden_expect_failed(
+          const char* expr, const char* path, const std::string& error, const char* file, std::size_t line) {
+        current_test_failed = true;
+        failed_check_count++;
+        add_check(false, expr, file, line);
+        reporter->golden_check_failed(out(), expr, path, error, file, line);
+      }
+
+      NANO_TEST_COLD inline void expect_exception_failed(
+          const char* expected, bool unexpected, const char* file, std::size_t line) {
+        current_test_failed = true;
+        failed_check_count++;
+        if (journal) {
+          journal->check_failed(journal_test, expected, file, line);
+        }
+        exception_check_failed(expected, unexpected ? "unexpected exception" : "no exception", file, line);
+      }
+
+      inline std::ostream& out() { return output ? *output : std::cout; }
+
+      inline void check_failed(const char* expr, const char* file, std::size_t line) {
+        reporter->check_failed(out(), expr, file, line);
+      }
+
+      inline void performance_check_failed(
+          const char* expr, const char* file, std::size_t line, double measured_ns, double limit_ns) {
+        reporter->performance_check_failed(out(), expr, file, line, measured_ns, limit_ns);
+      }
+
+      inline void exception_check_failed(const char* expected, const char* got, const char* file, std::size_t line) {
+        reporter->exception_check_failed(out(), expected, got, file, line);
+      }
+
+      inline void start_group(const test_group& g, std::size_t test_count) {
+        current_group = g.name.c_str();
+
+        group_start_time = detail::clock::now();
+        reporter->begin_group(out(), g.name, test_count);
+      }
+
+      inline void end_group(const test_group& g) { reporter->end_group(out(), g.name, group_ns()); }
+
+      inline void run_test(const test_item& t) {
+        current_item = &t;
+        current_test = t.name;
+        current_test_failed = false;
+        check_count = 0;
+        failed_check_count = 0;
+        test_start_time = detail::clock::now();
+
+        reporter->begin_test(out(), current_group, t);
+
+        if (journal) {
+          journal_test = journal->begin_test(current_group, t.name);
+        }
+
+        {
+          // Only the test itself is timed, it is disarmed before the test is reported.
+#ifdef NANO_TEST_HAS_THREADS
+          detail::watchdog::scope watch(
+              watchdog, watchdog_slot, detail::test_timeout(t, timeout), this, current_group, t);
+#endif
+
+          try {
+            t.fct();
+          } catch (const NANO_NAMESPACE::test::test_exception<>& e) {
+            failed_check_count++;
+            current_test_failed = true;
+            reporter->assert_failed(out(), e.what());
+            if (journal) {
+              journal->assert_failed(journal_test, e.what());
+            }
+          } catch (const std::exception&) {
+            // Other errors, rethrown with their type.
+            throw;
+          }
+        }
+
+        // Benchmarks record their samples instead, the duration of the whole calibration is meaningless.
+        if (timings && !current_test_failed && !(t.flags & NANO_TEST_BENCHMARK)) {
+          timing_record r;
+          r.group = current_group;
+          r.item = &t;
+          r.samples_ns.push_back(test_ns());
+          timings->push_back(r);
+        }
+
+        if (current_test_failed) {
+          failed_count++;
+        }
+        else {
+          passed_count++;
+        }
+
+        report(!current_test_failed);
+
+        if (journal) {
+          journal->end_test(journal_test, !current_test_failed, test_ns(), check_count, failed_check_count);
+          journal_test = 0;
+        }
+
+        if (current_test_failed) {
+          if (t.flags & NANO_TEST_ABORT_ON_ERROR) {
+            should_stop = true;
+          }
+        }
+      }
+
+      inline void report(bool passed) {
+        reporter->end_test(out(), current_group, *current_item, passed, check_count, failed_check_count, test_ns());
+      }
+
+      inline double test_ns() const { return detail::clock::elapsed_ns(test_start_time); }
+      inline double group_ns() const { return detail::clock::elapsed_ns(group_start_time); }
+      inline double launch_ns() const { return detail::clock::elapsed_ns(launch_start_time); }
+
+#ifdef NANO_TEST_CPP_98
+      typedef double us_count;
+#else
+      typedef std::chrono::microseconds::rep us_count;
+#endif
+
+      inline us_count test_us() const { return static_cast<us_count>(test_ns() / 1000.0); }
+      inline us_count group_us() const { return static_cast<us_count>(group_ns() / 1000.0); }
+      inline us_count launch_us() const { return static_cast<us_count>(launch_ns() / 1000.0); }
+
+      inline static NANO_TEST_CONSTEXPR const char* test(std::size_t count) {
+        return count <= 1 ? detail::kTest : detail::kTests;
+      }
+
+      inline static NANO_TEST_CONSTEXPR const char* group(std::size_t count) { return count <= 1 ? "group" : "groups"; }
+    };
+
+    static inline void release_instance() {
+      manager*& ptr = get_instance_ptr();
+      delete ptr;
+      ptr = NANO_TEST_NULLPTR;
+    }
+
+    static inline manager& get_instance() {
+      return *get_instance_ptr();
+    }
+
+    static inline state& state() {
+#ifdef NANO_TEST_HAS_THREADS
+      if (struct state* s = thread_state()) {
+        return *s;
+      }
+#endif
+      return get_instance().m_state;
+    }
+
+    /// Called once per test from the static constructors, only appends a record.
+    /// The records are sorted and grouped by index_tests when the tests run.
+    /// With NANO_TEST_SECTION_REGISTRATION the TEST_CASE macros never call it.
+    static inline void add_test(const char* group, const char* name, const char* desc, const char* opts, long flags,
+        test_function fct, const char* file = "", std::size_t line = 0) {
+      (void)opts;
+      const test_record r = { group, { name, desc, fct, flags, file, line } };
+      get_instance().m_records.push_back(r);
+    }
+
+    inline static int run(int argc, const char* argv[]);
+    inline static int run(int argc, const char* argv[], std::vector<check_result>& results);
+    inline static int run(int argc, const char* argv[], check_summary& summary);
+
+    static inline const benchmark_options& get_benchmark_options() { return get_instance().m_benchmark_options; }
+
+    /// Sets the reporter used by the following runs, the console reporter when null.
+    /// The reporter is not owned by the manager.
+    static inline void set_reporter(reporter* r) {
+      manager& m = get_instance();
+      m.m_reporter = r ? r : &m.m_console;
+    }
+
+#ifdef NANO_TEST_HAS_THREADS
+    /// Handle on the test running on the calling thread, captured by the threads the test spawns.
+    class test_context {
+    public:
+      inline test_context()
+          : m_state(NANO_TEST_NULLPTR) {}
+
+    private:
+      friend class manager;
+      struct state* m_state;
+    };
+
+    /// Binds the test of a context to the calling thread for the lifetime of the scope, so that the
+    /// checks of a thread spawned by a test count in that test with --jobs.
+    class test_scope {
+    public:
+      inline explicit test_scope(const test_context& c)
+          : m_previous(thread_state()) {
+        if (c.m_state) {
+          thread_state() = c.m_state;
+        }
+      }
+
+      inline ~test_scope() { thread_state() = m_previous; }
+
+    private:
+      struct state* m_previous;
+
+      test_scope(const test_scope&);
+      test_scope& operator=(const test_scope&);
+    };
+
+    static inline test_context current_test() {
+      test_context c;
+      c.m_state = &state();
+      return c;
+    }
+#endif
+
+  private:
+    inline manager()
+        : m_reporter(&m_console)
+        , m_file_reporter(NANO_TEST_NULLPTR)
+        , m_group_count(0)
+        , m_unbound_failed_checks(0)
+#ifdef NANO_TEST_HAS_SECTION_REGISTRATION
+        , m_section_loaded(false)
+#endif
+    {
+    }
+
+    /// Tests of a group that passed -g, --filter and --tags, in name order.
+    struct selection {
+      const test_group* group;
+      std::vector<const test_item*> items;
+    };
+
+    typedef std::vector<selection> group_vector;
+
+    /// Registered tests in registration order, sorted by group and name once indexed.
+    std::vector<test_record> m_records;
+
+    /// Sorted copy of the records, m_groups slices it.
+    std::vector<test_item> m_items;
+    std::vector<test_group> m_groups;
+    struct state m_state;
+    detail::check_recorder m_recorder;
+    detail::output_buffer m_output;
+    console_reporter m_console;
+    reporter* m_reporter;
+    benchmark_options m_benchmark_options;
+    std::vector<timing_record> m_timings;
+    detail::journal m_journal;
+    junit_reporter m_junit;
+    json_reporter m_json;
+    tee_reporter m_tee;
+
+    /// Report file of --report-file, null when there is none.
+    file_reporter* m_file_reporter;
+
+    /// Number of selected groups, for the summary of a run that timed out.
+    std::size_t m_group_count;
+
+    /// Failed checks of threads spawned by a test without a test_scope during a parallel run.
+    std::size_t m_unbound_failed_checks;
+#ifdef NANO_TEST_HAS_THREADS
+    /// Serializes the output of the worker threads and the report of a timeout.
+    std::mutex m_report_mutex;
+#endif
+#ifdef NANO_TEST_HAS_SECTION_REGISTRATION
+    bool m_section_loaded;
+#endif
+
+    inline int run_impl(
+        int argc, const char* argv[], std::vector<check_result>* results, check_summary* summary = NANO_TEST_NULLPTR);
+    inline void index_tests();
+    inline void select_tests(const std::set<std::string>& groups, const detail::test_filter& filter,
+        group_vector& selected, std::size_t& test_count) const;
+    static inline void select_shard(group_vector& groups, std::size_t& test_count, std::size_t shard_index,
+        std::size_t shard_count, const std::string& baseline_path);
+    static inline void list_tests(std::ostream& os, const group_vector& groups, bool json);
+
+    typedef std::map<const test_item*, detail::execution_cache::entry> cache_entries;
+
+    inline std::size_t skip_cached(group_vector& groups, std::size_t& test_count, const detail::execution_cache& cache,
+        unsigned long long seed, cache_entries& entries, std::vector<std::string>& unreadable) const;
+    inline bool save_cache(
+        const std::string& path, const detail::execution_cache& cache, const cache_entries& entries) const;
+    inline void run_serial(const group_vector& groups);
+    inline std::size_t compare_baseline(const std::string& path, double threshold, bool update);
+
+    struct job {
+      inline job(const test_group* _group, const test_item* _item)
+          : group(_group)
+          , item(_item) {}
+
+      const test_group* group;
+      const test_item* item;
+    };
+
+    /// Crash hook of the output buffer, writes the test of the crashing thread to the journal and ends the run.
+    static inline void journal_crash(int sig) {
+      const struct state& s = state();
+      if (s.journal) {
+        s.journal->crash(sig, s.journal_test);
+        s.journal->abort_run();
+      }
+    }
+
+    /// Flattens the tests of the given groups in registration order.
+    static inline void collect_jobs(const group_vector& groups, std::vector<job>& jobs) {
+      for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+        for (std::size_t i = 0; i < g->items.size(); i++) {
+          jobs.push_back(job(g->group, g->items[i]));
+        }
+      }
+    }
+
+    /// True when a test has a timeout, from its NANO_TEST_TIMEOUT flag or from --timeout.
+    static inline bool has_timeout(const group_vector& groups, double default_timeout) {
+      for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+        for (std::size_t i = 0; i < g->items.size(); i++) {
+          if (detail::test_timeout(*g->items[i], default_timeout) > 0) {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+#ifdef NANO_TEST_HAS_THREADS
+    struct worker {
+      inline worker()
+          : stream(&output) {}
+
+      struct state state;
+      detail::test_output output;
+      std::ostream stream;
+      std::vector<timing_record> timings;
+    };
+
+    inline void run_parallel(const group_vector& groups, std::size_t worker_count);
+
+    /// Watchdog handler of the serial and parallel runs. The test thread cannot be stopped, so the
+    /// timeout and the summary of the tests that ended are printed and the process exits.
+    NANO_TEST_NORETURN static inline void test_timed_out(
+        void* context, void* data, const char* group, const test_item& item, double seconds);
+
+    /// State of the test running on the calling thread, null on the threads spawned by a test.
+    static inline struct state*& thread_state() {
+      static thread_local struct state* s = nullptr;
+      return s;
+    }
+
+    /// Binds a state to the calling thread for the lifetime of the scope.
+    struct thread_state_scope {
+      inline explicit thread_state_scope(struct state& s) { thread_state() = &s; }
+      inline ~thread_state_scope() { thread_state() = nullptr; }
+    };
+#endif
+
+#ifdef NANO_TEST_HAS_FORK
+    struct shard {
+      inline shard()
+          : pid(-1)
+          , fd(-1)
+          , next(0)
+          , running(false)
+          , timeout(0)
+          , timed_out(false) {}
+
+      pid_t pid;
+      int fd;
+
+      /// Indices of the jobs assigned to this shard.
+      std::vector<std::size_t> jobs;
+
+      /// Position in jobs of the next test that was not started yet.
+      std::size_t next;
+
+      /// Bytes received from the shard process and not parsed yet.
+      std::string buffer;
+
+      bool running;
+
+      /// Start and timeout in seconds of the running test, it is killed once timed out.
+      detail::clock::tick_type start_time;
+      double timeout;
+      bool timed_out;
+    };
+
+    inline void run_sharded(const group_vector& groups, std::size_t shard_count);
+    inline bool spawn_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs);
+    inline void start_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs);
+    NANO_TEST_NORETURN inline void run_shard_process(int fd, const shard& s, const std::vector<job>& jobs);
+    NANO_TEST_NORETURN inline void exit_shard_process(
+        int fd, std::size_t index, std::ostringstream& stream, const char* what);
+    inline void read_shard_records(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs);
+    inline void end_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs);
+    static inline int kill_timed_out_shards(std::vector<shard>& shards);
+#endif
+
+    /// Orders by group then by name, stable sorting keeps the registration order of equal names.
+    struct record_comparator {
+      inline bool operator()(const test_record& a, const test_record& b) const {
+        const int c = std::strcmp(a.group, b.group);
+        return c != 0 ? c < 0 : std::strcmp(a.item.name, b.item.name) < 0;
+      }
+    };
+
+    static inline manager*& get_instance_ptr() {
+      NANO_TEST_CLANG_PUSH_WARNING("-Wexit-time-destructors")
+      static manager* tm = new manager();
+      return tm;
+      NANO_TEST_CLANG_POP_WARNING()
+    }
+  };
+
+  // MARK: - Inline implementations -
+
+#ifdef NANO_TEST_CPP_98
+  template <typename T1, typename T2, typename T3>
+  inline bool is_approximately_equal(T1 a, T2 b, T3 tolerance) {
+    typedef typename detail::float_common_return<T1, T2>::type ftype;
+
+    const ftype fa = static_cast<ftype>(a);
+    const ftype fb = static_cast<ftype>(b);
+    const ftype t = static_cast<ftype>(tolerance);
+    return (std::abs(fa - fb) <= t) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * t));
+  }
+
+  template <typename T1, typename T2>
+  inline bool is_approximately_equal(T1 a, T2 b, double tolerance = std::numeric_limits<double>::epsilon()) {
+    typedef typename detail::float_common_return<T1, T2>::type ftype;
+
+    const ftype fa = static_cast<ftype>(a);
+    const ftype fb = static_cast<ftype>(b);
+    const ftype t = static_cast<ftype>(tolerance);
+    return (std::abs(fa - fb) <= t) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * t));
+  }
+
+#else
+  template <typename T1, typename T2>
+  inline bool is_approximately_equal(T1 a, T2 b,
+      typename detail::float_common_return<T1, T2>::type tolerance
+      = std::numeric_limits<typename detail::float_common_return<T1, T2>::type /**/>::epsilon()) {
+    typedef typename detail::float_common_return<T1, T2>::type ftype;
+
+    const ftype fa = static_cast<ftype>(a);
+    const ftype fb = static_cast<ftype>(b);
+    return (std::abs(fa - fb) <= tolerance) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * tolerance));
+  }
+#endif
+
+#define NANO_TEST_DECL_COMP(name, comp)                                                                                \
+  struct comp_##name {                                                                                                 \
+    template <typename T1, typename T2>                                                                                \
+    inline NANO_TEST_CONSTEXPR bool operator()(const T1& a, const T2& b) const {                                       \
+      return a comp b;                                                                                                 \
+    }                                                                                                                  \
+  }
+
+  NANO_TEST_DECL_COMP(eq, ==);
+  NANO_TEST_DECL_COMP(ne, !=);
+  NANO_TEST_DECL_COMP(lt, <);
+  NANO_TEST_DECL_COMP(le, <=);
+  NANO_TEST_DECL_COMP(gt, >);
+  NANO_TEST_DECL_COMP(ge, >=);
+
+#undef NANO_TEST_DECL_COMP
+
+  int manager::run(int argc, const char* argv[]) { return get_instance().run_impl(argc, argv, NANO_TEST_NULLPTR); }
+
+  int manager::run(int argc, const char* argv[], std::vector<check_result>& results) {
+    return get_instance().run_impl(argc, argv, &results);
+  }
+
+  int manager::run(int argc, const char* argv[], check_summary& summary) {
+    return get_instance().run_impl(argc, argv, NANO_TEST_NULLPTR, &summary);
+  }
+
+  int manager::run_impl(int argc, const char* argv[], std::vector<check_result>* results, check_summary* summary) {
+
+    argparse::argument_parser parser("utest", "Unit tests runner");
+    parser.add_argument("-v", "--verbose", "verbose", false).count(0);
+    parser.add_argument("-g", "--groups", "group tests to run", false);
+    parser.add_argument("--filter", "globs over group.name, positive[:positive][-negative[:negative]]", false)
+        .count(1);
+    parser.add_argument("--tags", "tags of the tests to run, ~tag excludes", false);
+    parser.add_argument("--shard-index", "index of the shard to run, with --shard-count", false).count(1);
+    parser.add_argument("--shard-count", "number of shards balanced by the baseline durations", false).count(1);
+    parser.add_argument("--incremental", "skip the tests whose source is unchanged since they passed", false).count(0);
+    parser.add_argument("--cache-file", "cache of --incremental (default: next to the executable)", false).count(1);
+    parser.add_argument("--cache-key", "key mixed in the --incremental hashes with the build", false).count(1);
+    parser.add_argument("--list-tests", "print the selected tests without running them", false).count(0);
+    parser.add_argument("--list-format", "lines or json (default: lines)", false).count(1);
+    parser.add_argument("--output", "immediate or buffered (default: immediate on a terminal)", false).count(1);
+    parser.add_argument("--benchmark-samples", "number of samples per benchmark", false).count(1);
+    parser.add_argument("--benchmark-sample-time", "minimum duration of a benchmark sample in us", false).count(1);
+    parser.add_argument("--clock", "tsc or steady (default: tsc when invariant)", false).count(1);
+    parser.add_argument("--no-check-time", "do not timestamp the recorded checks", false).count(0);
+    parser.add_argument("--baseline-file", "timing baseline to compare with, created when missing", false).count(1);
+    parser.add_argument("--update-baseline", "save the timings of this run to the baseline file", false).count(0);
+    parser.add_argument("--regression-threshold", "slowdown in percent reported as a regression", false).count(1);
+    parser.add_argument("--fail-on-regression", "count regressions as failures", false).count(0);
+    parser.add_argument("--update-golden", "write the golden files instead of comparing with them", false).count(0);
+    parser.add_argument("--report-file", "file the report is written to as the tests run", false).count(1);
+    parser.add_argument("--report-format", "junit or json (default: junit)", false).count(1);
+#ifdef NANO_TEST_HAS_POSIX
+    parser.add_argument("--journal", "memory mapped file the results are written to as the tests run", false).count(1);
+#endif
+#if defined(NANO_TEST_HAS_THREADS) || defined(NANO_TEST_HAS_FORK)
+    parser.add_argument("--timeout", "seconds after which a test fails (default: none)", false).count(1);
+#endif
+#ifdef NANO_TEST_HAS_THREADS
+    parser.add_argument("-j", "--jobs", "number of worker threads (0 for all cores)", false).count(1);
+#endif
+#ifdef NANO_TEST_HAS_FORK
+    parser.add_argument("--shards", "number of forked processes", false).count(1);
+#endif
+    parser.enable_help();
+
+    argparse::result err = parser.parse(argc, argv);
+    if (err) {
+      std::cout << err << std::endl;
+      return -1;
+    }
+
+    if (parser.exists("help")) {
+      parser.print_help();
+      return 0;
+    }
+
+    const std::vector<std::string>* groups_ptr = NANO_TEST_NULLPTR;
+    const argparse::argument* groups_arg = parser.get_argument("groups");
+    if (groups_arg) {
+      const std::vector<std::string>& groups = groups_arg->get_values();
+      groups_ptr = &groups;
+    }
+    //    bool hasGroups = parser.get_argument("groups")->get_values()
+
+    std::set<std::string> group_map;
+
+    if (groups_ptr) {
+      for (std::size_t i = 0; i < groups_ptr->size(); i++) {
+        group_map.insert(groups_ptr->operator[](i));
+      }
+    }
+
+    detail::test_filter filter;
+    if (const argparse::argument* filter_arg = parser.get_argument("filter")) {
+      filter.set_patterns(filter_arg->get_values()[0]);
+    }
+
+    if (const argparse::argument* tags_arg = parser.get_argument("tags")) {
+      for (std::size_t i = 0; i < tags_arg->get_values().size(); i++) {
+        filter.add_tag(tags_arg->get_values()[i]);
+      }
+    }
+
+    index_tests();
+
+    group_vector selected_groups;
+    std::size_t test_count = 0;
+    select_tests(group_map, filter, selected_groups, test_count);
+
+    std::string baseline_path;
+    if (const argparse::argument* baseline_arg = parser.get_argument("baseline-file")) {
+      baseline_path = baseline_arg->get_values()[0];
+    }
+
+    if (const argparse::argument* count_arg = parser.get_argument("shard-count")) {
+      const argparse::argument* index_arg = parser.get_argument("shard-index");
+      const std::size_t shard_count
+          = static_cast<std::size_t>(std::strtoul(count_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR, 10));
+      const std::size_t shard_index = index_arg
+          ? static_cast<std::size_t>(std::strtoul(index_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR, 10))
+          : 0;
+
+      if (shard_count == 0 || shard_index >= shard_count) {
+        std::cout << "--shard-index must be smaller than --shard-count" << std::endl;
+        return -1;
+      }
+
+      select_shard(selected_groups, test_count, shard_index, shard_count, baseline_path);
+    }
+
+    // Listing runs nothing, the clock and the state are left untouched.
+    if (parser.exists("list-tests")) {
+      const argparse::argument* format_arg = parser.get_argument("list-format");
+      list_tests(std::cout, selected_groups, format_arg && format_arg->get_values()[0] == "json");
+      return 0;
+    }
+
+    std::string cache_path;
+    detail::execution_cache cache;
+    cache_entries cached_entries;
+    std::vector<std::string> uncached_sources;
+    std::size_t cached_count = 0;
+
+    if (parser.exists("incremental")) {
+      const argparse::argument* cache_arg = parser.get_argument("cache-file");
+      const argparse::argument* key_arg = parser.get_argument("cache-key");
+
+      const std::string key = key_arg ? key_arg->get_values()[0] : std::string();
+      const std::string executable = detail::executable_path(argv[0]);
+
+      // The file of a test is hashed with the build, any change to the code it tests reruns it.
+      const unsigned long long identity = detail::build_identity(executable);
+      if (!identity && key.empty()) {
+        std::cout << "--incremental cannot identify the build of '" << executable
+                  << "', pass a --cache-key that changes with the code under test" << std::endl;
+        return -1;
+      }
+
+      cache_path = cache_arg ? cache_arg->get_values()[0] : executable + ".testcache";
+
+      cache.load(cache_path);
+      const unsigned long long seed = detail::fnv1a(key.data(), key.size(), detail::fnv1a(&identity, sizeof(identity)));
+      cached_count = skip_cached(selected_groups, test_count, cache, seed, cached_entries, uncached_sources);
+    }
+
+    std::size_t jobs = 1;
+#ifdef NANO_TEST_HAS_THREADS
+    if (const argparse::argument* jobs_arg = parser.get_argument("jobs")) {
+      jobs = static_cast<std::size_t>(std::strtoul(jobs_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR, 10));
+      if (jobs == 0) {
+        jobs = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+      }
+    }
+#endif
+
+    std::size_t shards = 0;
+#ifdef NANO_TEST_HAS_FORK
+    if (const argparse::argument* shards_arg = parser.get_argument("shards")) {
+      shards = static_cast<std::size_t>(std::strtoul(shards_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR, 10));
+    }
+#endif
+
+    bool immediate_output = detail::is_terminal_output();
+    if (const argparse::argument* output_arg = parser.get_argument("output")) {
+      immediate_output = output_arg->get_values()[0] != "buffered";
+    }
+
+    m_benchmark_options = benchmark_options();
+    if (const argparse::argument* samples_arg = parser.get_argument("benchmark-samples")) {
+      m_benchmark_options.samples = std::max<std::size_t>(
+          static_cast<std::size_t>(std::strtoul(samples_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR, 10)), 1);
+    }
+
+    if (const argparse::argument* time_arg = parser.get_argument("benchmark-sample-time")) {
+      m_benchmark_options.min_sample_ns = 1000.0 * std::strtod(time_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR);
+    }
+
+    double regression_threshold = 0.1;
+    if (const argparse::argument* threshold_arg = parser.get_argument("regression-threshold")) {
+      regression_threshold = 0.01 * std::strtod(threshold_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR);
+    }
+
+    detail::clock::source_type clock_source = detail::clock::tsc;
+    if (const argparse::argument* clock_arg = parser.get_argument("clock")) {
+      clock_source = clock_arg->get_values()[0] == "steady" ? detail::clock::steady : detail::clock::tsc;
+    }
+    detail::clock::set_source(clock_source);
+
+    m_state.recorder = results || summary ? &m_recorder : NANO_TEST_NULLPTR;
+    m_recorder.set_mode(summary ? detail::check_recorder::compact : detail::check_recorder::full);
+    m_state.check_timestamps = !parser.exists("no-check-time");
+    m_state.update_golden = parser.exists("update-golden");
+
+    m_state.journal = NANO_TEST_NULLPTR;
+    if (const argparse::argument* journal_arg = parser.get_argument("journal")) {
+      const std::string& path = journal_arg->get_values()[0];
+      if (!m_journal.open(path.c_str())) {
+        std::cout << "Cannot create the journal file '" << path << "'" << std::endl;
+        return -1;
+      }
+
+      std::vector<const char*> names;
+      for (group_vector::const_iterator g = selected_groups.begin(); g != selected_groups.end(); ++g) {
+        names.push_back(g->group->name.c_str());
+        for (std::size_t i = 0; i < g->items.size(); i++) {
+          names.push_back(g->items[i]->name);
+        }
+      }
+      m_journal.write_names(names);
+
+      m_state.journal = &m_journal;
+      detail::output_buffer::crash_hook() = &journal_crash;
+    }
+
+    // The console reporter and the report file both get the events through the tee.
+    reporter* const console = m_reporter;
+    m_file_reporter = NANO_TEST_NULLPTR;
+    if (const argparse::argument* report_arg = parser.get_argument("report-file")) {
+      const argparse::argument* format_arg = parser.get_argument("report-format");
+      m_file_reporter = format_arg && format_arg->get_values()[0] == "json" ? static_cast<file_reporter*>(&m_json)
+                                                                              : static_cast<file_reporter*>(&m_junit);
+
+      const std::string& path = report_arg->get_values()[0];
+      if (!m_file_reporter->open(path.c_str())) {
+        std::cout << "Cannot create the report file '" << path << "'" << std::endl;
+        m_file_reporter = NANO_TEST_NULLPTR;
+        if (m_state.journal) {
+          m_journal.close();
+          m_state.journal = NANO_TEST_NULLPTR;
+          detail::output_buffer::crash_hook() = NANO_TEST_NULLPTR;
+        }
+        return -1;
+      }
+
+      m_tee.clear();
+      m_tee.add(console);
+      m_tee.add(m_file_reporter);
+      m_reporter = &m_tee;
+    }
+    m_state.reporter = m_reporter;
+
+    m_state.timeout = 0;
+    if (const argparse::argument* timeout_arg = parser.get_argument("timeout")) {
+      m_state.timeout = std::max(std::strtod(timeout_arg->get_values()[0].c_str(), NANO_TEST_NULLPTR), 0.0);
+    }
+
+#ifdef NANO_TEST_HAS_THREADS
+    // The runner watches the shard processes itself.
+    std::unique_ptr<detail::watchdog> watchdog;
+    if (shards == 0 && has_timeout(selected_groups, m_state.timeout)) {
+      watchdog.reset(new detail::watchdog(jobs, &test_timed_out, this));
+    }
+    m_state.watchdog = watchdog.get();
+    m_state.watchdog_slot = 0;
+#endif
+
+    m_timings.clear();
+    m_state.timings = baseline_path.empty() && cache_path.empty() ? NANO_TEST_NULLPTR : &m_timings;
+
+    m_state.passed_count = 0;
+    m_state.failed_count = 0;
+    m_state.total_tests = test_count;
+    m_state.should_stop = false;
+
+    m_group_count = selected_groups.size();
+    m_unbound_failed_checks = 0;
+    m_output.attach(immediate_output);
+
+    if (!cache_path.empty()) {
+      for (std::size_t i = 0; i < uncached_sources.size(); i++) {
+        m_reporter->uncached_source(std::cout, uncached_sources[i].c_str());
+      }
+      m_reporter->cached(std::cout, cache_path.c_str(), cached_count);
+    }
+
+    m_reporter->begin_run(std::cout, m_state.total_tests, selected_groups.size());
+
+    m_state.launch_start_time = detail::clock::now();
+
+#ifdef NANO_TEST_HAS_THREADS
+    // The checks of the runner thread find its state without going through the manager instance.
+    thread_state_scope scope(m_state);
+#endif
+
+    if (shards > 0) {
+#ifdef NANO_TEST_HAS_FORK
+      run_sharded(selected_groups, shards);
+#endif
+    }
+    else if (jobs > 1) {
+#ifdef NANO_TEST_HAS_THREADS
+      run_parallel(selected_groups, jobs);
+#endif
+    }
+    else {
+      run_serial(selected_groups);
+    }
+
+    if (results) {
+      m_recorder.merge(*results);
+    }
+
+    if (summary) {
+      m_recorder.merge(summary->failures);
+      m_recorder.merge_sites(summary->sites);
+    }
+
+    if (m_state.should_stop) {
+      m_reporter->stopped(std::cout, m_state.current_group, m_state.current_test);
+    }
+
+    if (m_unbound_failed_checks) {
+      m_reporter->unbound_checks_failed(std::cout, m_unbound_failed_checks);
+    }
+
+    std::size_t regressions = 0;
+    if (!baseline_path.empty()) {
+      regressions = compare_baseline(baseline_path, regression_threshold, parser.exists("update-baseline"));
+    }
+
+    if (!cache_path.empty()) {
+      save_cache(cache_path, cache, cached_entries);
+    }
+
+    m_reporter->end_run(std::cout, m_state.total_tests, selected_groups.size(), m_state.passed_count,
+        m_state.failed_count, m_state.launch_ns());
+    m_output.detach();
+
+    if (m_state.journal) {
+      m_journal.end_run(m_state.passed_count, m_state.failed_count, m_state.launch_ns());
+      m_journal.close();
+      m_state.journal = NANO_TEST_NULLPTR;
+    }
+
+    if (m_file_reporter) {
+      m_file_reporter->close();
+      m_file_reporter = NANO_TEST_NULLPTR;
+      m_reporter = console;
+    }
+
+    if (!parser.exists("fail-on-regression")) {
+      regressions = 0;
+    }
+
+    return static_cast<int>(m_state.failed_count + regressions + (m_unbound_failed_checks ? 1 : 0));
+  }
+
+  std::size_t manager::compare_baseline(const std::string& path, double threshold, bool update) {
+    // Significance level of the Mann-Whitney test.
+    const double alpha = 0.05;
+
+    detail::baseline baseline;
+    const bool loaded = baseline.load(path);
+
+    std::size_t compared = 0;
+    std::size_t regressions = 0;
+
+    for (std::size_t i = 0; loaded && i < m_timings.size(); i++) {
+      const timing_record& r = m_timings[i];
+      const std::string key = detail::baseline::key(r);
+      detail::baseline::entry_map::const_iterator it = baseline.entries.find(key);
+
+      if (it == baseline.entries.end() || it->second.benchmark != r.benchmark || it->second.samples_ns.empty()) {
+        continue;
+      }
+
+      compared++;
+      const double baseline_ns = detail::median(it->second.samples_ns);
+      const double current_ns = detail::median(r.samples_ns);
+      const double p = detail::mann_whitney_p(it->second.samples_ns, r.samples_ns);
+
+      if (current_ns > baseline_ns * (1.0 + threshold) && p < alpha) {
+        regressions++;
+        m_reporter->regression(std::cout, key, r.benchmark, baseline_ns, current_ns, p);
+      }
+    }
+
+    bool saved = false;
+    if (!loaded || update) {
+      for (std::size_t i = 0; i < m_timings.size(); i++) {
+        baseline.update(m_timings[i]);
+      }
+      saved = baseline.save(path);
+    }
+
+    m_reporter->baseline(std::cout, path.c_str(), compared, regressions, saved);
+    return regressions;
+  }
+
+  void manager::index_tests() {
+#ifdef NANO_TEST_HAS_SECTION_REGISTRATION
+    // The section records come first, as if their constructors ran before any explicit add_test.
+    if (!m_section_loaded) {
+      m_records.insert(m_records.begin(), detail::__start_nano_test_records, detail::__stop_nano_test_records);
+      m_section_loaded = true;
+    }
+#endif
+
+    if (m_items.size() == m_records.size()) {
+      return;
+    }
+
+    std::stable_sort(m_records.begin(), m_records.end(), record_comparator());
+
+    m_items.clear();
+    m_groups.clear();
+    m_items.reserve(m_records.size());
+
+    for (std::size_t i = 0; i < m_records.size(); i++) {
+      if (m_groups.empty() || m_groups.back().name != m_records[i].group) {
+        test_group g;
+        g.name = m_records[i].group;
+        g.items = m_items.data() + m_items.size();
+        g.size = 0;
+        m_groups.push_back(g);
+      }
+
+      m_items.push_back(m_records[i].item);
+      m_groups.back().size++;
+    }
+  }
+
+  void manager::select_tests(const std::set<std::string>& groups, const detail::test_filter& filter,
+      group_vector& selected, std::size_t& test_count) const {
+    for (std::vector<test_group>::const_iterator g = m_groups.begin(); g != m_groups.end(); ++g) {
+      if ((!groups.empty() && groups.find(g->name) == groups.end()) || !filter.may_match_group(g->name)) {
+        continue;
+      }
+
+      selection s;
+      s.group = &*g;
+      for (const test_item* t = g->begin(); t != g->end(); ++t) {
+        if (filter.matches(g->name, *t)) {
+          s.items.push_back(t);
+        }
+      }
+
+      if (!s.items.empty()) {
+        test_count += s.items.size();
+        selected.push_back(selection());
+        selected.back().group = s.group;
+        selected.back().items.swap(s.items);
+      }
+    }
+  }
+
+  void manager::select_shard(group_vector& groups, std::size_t& test_count, std::size_t shard_index,
+      std::size_t shard_count, const std::string& baseline_path) {
+    detail::baseline baseline;
+    if (!baseline_path.empty()) {
+      baseline.load(baseline_path);
+    }
+
+    // Benchmark entries hold per iteration samples, only test durations are usable.
+    std::vector<double> weights;
+    std::vector<double> known;
+    for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+      for (std::size_t i = 0; i < g->items.size(); i++) {
+        detail::baseline::entry_map::const_iterator it
+            = baseline.entries.find(detail::baseline::key(g->group->name.c_str(), g->items[i]->name));
+        const bool has_duration
+            = it != baseline.entries.end() && !it->second.benchmark && !it->second.samples_ns.empty();
+        weights.push_back(has_duration ? detail::median(it->second.samples_ns) : -1);
+        if (has_duration) {
+          known.push_back(weights.back());
+        }
+      }
+    }
+
+    // Tests without history weigh the median known duration, or all the same without a baseline.
+    const double unknown_ns = known.empty() ? 1.0 : detail::median(known);
+    for (std::size_t i = 0; i < weights.size(); i++) {
+      weights[i] = weights[i] < 0 ? unknown_ns : weights[i];
+    }
+
+    std::vector<std::size_t> assignment;
+    detail::plan_shards(weights, shard_count, assignment);
+
+    std::size_t index = 0;
+    test_count = 0;
+    group_vector selected;
+    for (group_vector::iterator g = groups.begin(); g != groups.end(); ++g) {
+      selection s;
+      s.group = g->group;
+      for (std::size_t i = 0; i < g->items.size(); i++) {
+        if (assignment[index++] == shard_index) {
+          s.items.push_back(g->items[i]);
+        }
+      }
+
+      if (!s.items.empty()) {
+        test_count += s.items.size();
+        selected.push_back(s);
+      }
+    }
+
+    groups.swap(selected);
+  }
+
+  std::size_t manager::skip_cached(group_vector& groups, std::size_t& test_count, const detail::execution_cache& cache,
+      unsigned long long seed, cache_entries& entries, std::vector<std::string>& unreadable) const {
+    // Hash of every source file, 0 when it cannot be read and its tests always run.
+    std::map<std::string, unsigned long long> sources;
+
+    std::size_t skipped = 0;
+    test_count = 0;
+    group_vector remaining;
+    for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+      selection s;
+      s.group = g->group;
+      for (std::size_t i = 0; i < g->items.size(); i++) {
+        const test_item& t = *g->items[i];
+
+        // Benchmarks are measurements, they always run.
+        if (t.flags & NANO_TEST_BENCHMARK) {
+          s.items.push_back(&t);
+          continue;
+        }
+
+        std::map<std::string, unsigned long long>::iterator source = sources.find(t.file);
+        if (source == sources.end()) {
+          detail::mapped_file file;
+          const unsigned long long hash = file.open(t.file) ? detail::fnv1a(file.data(), file.size(), seed) : 0;
+          source = sources.insert(std::make_pair(std::string(t.file), hash)).first;
+          if (hash == 0) {
+            unreadable.push_back(t.file);
+          }
+        }
+
+        if (source->second != 0) {
+          const std::string name = detail::baseline::key(g->group->name.c_str(), t.name);
+          detail::execution_cache::entry e;
+          e.name = detail::fnv1a(name.data(), name.size());
+          e.content = detail::fnv1a(&t.flags, sizeof(t.flags), detail::fnv1a(name.data(), name.size(), source->second));
+
+          if (cache.passed(e.name, e.content)) {
+            skipped++;
+            continue;
+          }
+
+          entries[&t] = e;
+        }
+
+        s.items.push_back(&t);
+      }
+
+      if (!s.items.empty()) {
+        test_count += s.items.size();
+        remaining.push_back(s);
+      }
+    }
+
+    groups.swap(remaining);
+    return skipped;
+  }
+
+  bool manager::save_cache(
+      const std::string& path, const detail::execution_cache& cache, const cache_entries& entries) const {
+    // Every test that was meant to run loses its previous entry, only the passes of this run are added back.
+    std::vector<unsigned long long> ran;
+    for (cache_entries::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+      ran.push_back(it->second.name);
+    }
+    std::sort(ran.begin(), ran.end());
+
+    std::vector<detail::execution_cache::entry> passes;
+    for (std::size_t i = 0; i < m_timings.size(); i++) {
+      cache_entries::const_iterator it = entries.find(m_timings[i].item);
+      if (!m_timings[i].benchmark && it != entries.end()) {
+        passes.push_back(it->second);
+      }
+    }
+
+    return cache.save(path, passes, ran);
+  }
+
+  void manager::list_tests(std::ostream& os, const group_vector& groups, bool json) {
+    if (json) {
+      os << "{\"tests\":[";
+    }
+
+    const char* separator = "";
+    for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+      for (std::size_t i = 0; i < g->items.size(); i++) {
+        const test_item& t = *g->items[i];
+
+        if (!json) {
+          os << g->group->name << '\t' << t.name << '\t' << t.file << ':' << t.line << '\t' << t.flags << '\t' << t.desc
+             << '\n';
+          continue;
+        }
+
+        os << separator << "\n{\"group\":";
+        detail::write_json_string(os, g->group->name.c_str());
+        os << ",\"name\":";
+        detail::write_json_string(os, t.name);
+        os << ",\"desc\":";
+        detail::write_json_string(os, t.desc);
+        os << ",\"flags\":" << t.flags << ",\"file\":";
+        detail::write_json_string(os, t.file);
+        os << ",\"line\":" << t.line << "}";
+        separator = ",";
+      }
+    }
+
+    if (json) {
+      os << "\n]}\n";
+    }
+
+    os.flush();
+  }
+
+  void manager::run_serial(const group_vector& groups) {
+    for (group_vector::const_iterator g = groups.begin(); g != groups.end(); ++g) {
+      m_state.start_group(*g->group, g->items.size());
+
+      for (std::size_t i = 0; i < g->items.size(); i++) {
+        m_state.run_test(*g->items[i]);
+        std::cout.flush();
+
+        if (m_state.should_stop) {
+          break;
+        }
+      }
+
+      m_state.end_group(*g->group);
+
+      if (m_state.should_stop) {
+        break;
+      }
+    }
+  }
+
+#ifdef NANO_TEST_HAS_THREADS
+  void manager::run_parallel(const group_vector& groups, std::size_t worker_count) {
+    std::vector<job> jobs;
+    collect_jobs(groups, jobs);
+
+    worker_count = std::min(worker_count, jobs.size());
+    if (worker_count == 0) {
+      return;
+    }
+
+    m_reporter->begin_parallel(std::cout, jobs.size(), worker_count);
+
+    detail::work_stealing_scheduler scheduler(worker_count, jobs.size());
+    std::vector<worker> workers(worker_count);
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop(false);
+    std::exception_ptr error;
+
+    // The runner state gets the checks of the threads spawned by a test without a test_scope.
+    m_state.check_count = 0;
+    m_state.failed_check_count = 0;
+
+    for (std::size_t i = 0; i < worker_count; i++) {
+      threads.push_back(std::thread([&, i]() {
+        worker& w = workers[i];
+        w.state.output = &w.stream;
+        w.state.recorder = m_state.recorder;
+        w.state.reporter = m_state.reporter;
+        w.state.check_timestamps = m_state.check_timestamps;
+        w.state.update_golden = m_state.update_golden;
+        w.state.journal = m_state.journal;
+        w.state.timeout = m_state.timeout;
+        w.state.watchdog = m_state.watchdog;
+        w.state.watchdog_slot = i;
+        w.state.timings = m_state.timings ? &w.timings : NANO_TEST_NULLPTR;
+        thread_state_scope scope(w.state);
+
+        std::size_t index;
+        while (!stop.load(std::memory_order_relaxed) && scheduler.next(i, index)) {
+          const job& j = jobs[index];
+          w.state.current_group = j.group->name.c_str();
+          w.output.begin(w.state.current_group, j.item->name);
+
+          std::exception_ptr test_error;
+          try {
+            w.state.run_test(*j.item);
+          } catch (...) {
+            test_error = std::current_exception();
+          }
+
+          std::lock_guard<std::mutex> lock(m_report_mutex);
+          w.output.end(std::cout);
+          std::cout.flush();
+
+          // Counted as the tests end, a timeout report includes them.
+          if (!test_error) {
+            if (w.state.current_test_failed) {
+              m_state.failed_count++;
+            }
+            else {
+              m_state.passed_count++;
+            }
+          }
+
+          if (test_error && !error) {
+            error = test_error;
+            stop = true;
+          }
+
+          if (w.state.should_stop && !m_state.should_stop) {
+            m_state.should_stop = true;
+            m_state.current_group = w.state.current_group;
+            m_state.current_test = w.state.current_test;
+            stop = true;
+          }
+        }
+      }));
+    }
+
+    for (std::size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+
+    m_unbound_failed_checks = m_state.failed_check_count;
+    std::cout << "\n";
+
+    for (std::size_t i = 0; i < workers.size() && m_state.timings; i++) {
+      m_state.timings->insert(m_state.timings->end(), workers[i].timings.begin(), workers[i].timings.end());
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void manager::test_timed_out(void* context, void* data, const char* group, const test_item& item, double seconds) {
+    manager& m = *static_cast<manager*>(context);
+    const struct state& s = *static_cast<const struct state*>(data);
+
+    std::lock_guard<std::mutex> lock(m.m_report_mutex);
+
+    // The output of a worker thread is buffered, only the runner thread printed the beginning of its test.
+    if (&s != &m.m_state) {
+      m.m_reporter->begin_test(std::cout, group, item);
+    }
+
+    const std::size_t failed_count = m.m_state.failed_count + 1;
+    if (s.journal) {
+      s.journal->timed_out(s.journal_test, seconds * 1e9);
+      s.journal->end_run(m.m_state.passed_count, failed_count, m.m_state.launch_ns(), true);
+    }
+
+    m.m_reporter->test_timed_out(std::cout, group, item, seconds * 1e9);
+    m.m_reporter->stopped(std::cout, group, item.name);
+    m.m_reporter->end_run(std::cout, m.m_state.total_tests, m.m_group_count, m.m_state.passed_count, failed_count,
+        m.m_state.launch_ns());
+    std::cout.flush();
+    m.m_output.write_pending();
+
+    // Unwinding or running the static destructors would wait for the test that is still running.
+    std::_Exit(static_cast<int>(failed_count));
+  }
+#endif // NANO_TEST_HAS_THREADS
+
+#ifdef NANO_TEST_HAS_FORK
+  void manager::run_sharded(const group_vector& groups, std::size_t shard_count) {
+    std::vector<job> jobs;
+    collect_jobs(groups, jobs);
+
+    shard_count = std::min(shard_count, jobs.size());
+    if (shard_count == 0) {
+      return;
+    }
+
+    m_reporter->begin_shards(std::cout, jobs.size(), shard_count);
+
+    std::vector<shard> shards(shard_count);
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+      shards[i % shard_count].jobs.push_back(i);
+    }
+
+    for (std::size_t i = 0; i < shards.size(); i++) {
+      start_shard(shards[i], shards, jobs);
+    }
+
+    std::vector<pollfd> fds;
+    std::vector<shard*> polled;
+
+    for (;;) {
+      fds.clear();
+      polled.clear();
+
+      for (std::size_t i = 0; i < shards.size(); i++) {
+        if (shards[i].fd >= 0) {
+          pollfd p;
+          p.fd = shards[i].fd;
+          p.events = POLLIN;
+          p.revents = 0;
+          fds.push_back(p);
+          polled.push_back(&shards[i]);
+        }
+      }
+
+      if (fds.empty()) {
+        break;
+      }
+
+      if (::poll(&fds[0], static_cast<nfds_t>(fds.size()), kill_timed_out_shards(shards)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+
+      for (std::size_t i = 0; i < fds.size(); i++) {
+        if (!fds[i].revents) {
+          continue;
+        }
+
+        shard& s = *polled[i];
+        char data[4096];
+        const ssize_t n = ::read(s.fd, data, sizeof(data));
+
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+
+        if (n > 0) {
+          s.buffer.append(data, static_cast<std::size_t>(n));
+          read_shard_records(s, shards, jobs);
+        }
+        else {
+          end_shard(s, shards, jobs);
+        }
+      }
+    }
+
+    std::cout << "\n";
+  }
+
+  void manager::start_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs) {
+    if (spawn_shard(s, shards, jobs)) {
+      return;
+    }
+
+    // Without a process the remaining tests of the shard cannot run, they fail instead of being left out.
+    const int error = errno;
+    for (; s.next < s.jobs.size(); s.next++) {
+      const job& j = jobs[s.jobs[s.next]];
+      m_state.failed_count++;
+      m_reporter->test_crashed(
+          std::cout, j.group->name.c_str(), *j.item, "Cannot start a shard process, errno", error);
+
+      if (m_state.recorder) {
+        m_recorder.push(check_result(j.group->name.c_str(), j.item, "not run", "", 0, 0, false));
+      }
+    }
+    std::cout << std::flush;
+  }
+
+  bool manager::spawn_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs) {
+    int p[2];
+    if (::pipe(p) != 0) {
+      return false;
+    }
+
+    // Anything still buffered would otherwise be printed by both processes.
+    m_output.write_pending();
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+      const int error = errno;
+      ::close(p[0]);
+      ::close(p[1]);
+      errno = error;
+      return false;
+    }
+
+    if (pid == 0) {
+      ::close(p[0]);
+      for (std::size_t i = 0; i < shards.size(); i++) {
+        if (shards[i].fd >= 0) {
+          ::close(shards[i].fd);
+        }
+      }
+
+      run_shard_process(p[1], s, jobs);
+    }
+
+    ::close(p[1]);
+    s.pid = pid;
+    s.fd = p[0];
+    s.running = false;
+    s.timed_out = false;
+    s.buffer.clear();
+    return true;
+  }
+
+  void manager::run_shard_process(int fd, const shard& s, const std::vector<job>& jobs) {
+    std::ostringstream stream;
+    std::ostringstream report;
+    std::vector<check_result> results;
+    std::vector<check_site> sites;
+
+    m_state.output = &stream;
+
+    // The runner owns the report file, the tests formatted here are sent to it.
+    if (m_file_reporter) {
+      m_file_reporter->redirect(&report);
+    }
+
+    // The tests write to the shared journal, the runner writes the crash records since it knows the signal.
+    detail::output_buffer::crash_hook() = NANO_TEST_NULLPTR;
+
+    // Results recorded by the runner before the fork belong to the parent.
+    m_recorder.clear();
+    m_timings.clear();
+
+    // Only the runner may tear the process down: an exception escaping to main would close the shared
+    // journal and report file. The test is reported as exited with its output so far.
+    std::size_t index = 0;
+    try {
+      for (std::size_t i = s.next; i < s.jobs.size(); i++) {
+        index = s.jobs[i];
+        const job& j = jobs[index];
+
+        detail::write_shard_record(fd, detail::shard_record::begin_test, index, NANO_TEST_NULLPTR, 0);
+
+        stream.str(std::string());
+        report.str(std::string());
+        results.clear();
+        m_state.current_group = j.group->name.c_str();
+        m_state.run_test(*j.item);
+        m_recorder.merge(results);
+
+        const std::string text = stream.str();
+        detail::write_shard_record(fd, detail::shard_record::output, index, text.data(), text.size());
+
+        if (m_file_reporter) {
+          const std::string formatted = report.str();
+          detail::write_shard_record(fd, detail::shard_record::report, index, formatted.data(), formatted.size());
+        }
+
+        for (std::size_t r = 0; r < results.size(); r++) {
+          detail::shard_check c;
+          c.expr = results[r].expr;
+          c.file = results[r].file;
+          c.line = results[r].line;
+          c.end_time = results[r].end_time;
+          c.success = results[r].success;
+          detail::write_shard_record(fd, detail::shard_record::check, index, &c, sizeof(c));
+        }
+
+        // Site ids interned after the fork are unknown to the runner, sites are sent by value.
+        sites.clear();
+        m_recorder.merge_sites(sites);
+        for (std::size_t k = 0; k < sites.size(); k++) {
+          detail::shard_site c;
+          c.expr = sites[k].expr;
+          c.file = sites[k].file;
+          c.line = sites[k].line;
+          c.passed = sites[k].passed;
+          detail::write_shard_record(fd, detail::shard_record::site, index, &c, sizeof(c));
+        }
+
+        for (std::size_t t = 0; t < m_timings.size(); t++) {
+          detail::shard_timing h;
+          h.benchmark = m_timings[t].benchmark;
+
+          std::string payload(reinterpret_cast<const char*>(&h), sizeof(h));
+          const std::vector<double>& samples = m_timings[t].samples_ns;
+          payload.append(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(double));
+          detail::write_shard_record(fd, detail::shard_record::timing, index, payload.data(), payload.size());
+        }
+        m_timings.clear();
+
+        detail::shard_end e;
+        e.passed = !m_state.current_test_failed;
+        e.should_stop = m_state.should_stop;
+        detail::write_shard_record(fd, detail::shard_record::end_test, index, &e, sizeof(e));
+
+        if (m_state.should_stop) {
+          break;
+        }
+      }
+    } catch (const std::exception& e) {
+      exit_shard_process(fd, index, stream, e.what());
+    } catch (...) {
+      exit_shard_process(fd, index, stream, "unknown exception");
+    }
+
+    m_output.write_pending();
+    ::close(fd);
+    ::_exit(0);
+  }
+
+  void manager::exit_shard_process(int fd, std::size_t index, std::ostringstream& stream, const char* what) {
+    stream << "    > Unexpected exception: " << what << "\n";
+    const std::string text = stream.str();
+    detail::write_shard_record(fd, detail::shard_record::output, index, text.data(), text.size());
+
+    m_output.write_pending();
+    ::close(fd);
+    ::_exit(1);
+  }
+
+  void manager::read_shard_records(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs) {
+    std::size_t pos = 0;
+
+    while (s.buffer.size() - pos >= sizeof(detail::shard_record)) {
+      detail::shard_record r;
+      std::memcpy(&r, s.buffer.data() + pos, sizeof(r));
+
+      if (s.buffer.size() - pos - sizeof(r) < r.size) {
+        break;
+      }
+
+      const char* payload = s.buffer.data() + pos + sizeof(r);
+      const job& j = jobs[r.job];
+      pos += sizeof(r) + r.size;
+
+      switch (r.type) {
+      case detail::shard_record::begin_test:
+        s.running = true;
+        s.start_time = detail::clock::now();
+        s.timeout = detail::test_timeout(*j.item, m_state.timeout);
+        break;
+
+      case detail::shard_record::output:
+        std::cout.write(payload, static_cast<std::streamsize>(r.size));
+        break;
+
+      case detail::shard_record::report:
+        m_file_reporter->append(payload, r.size);
+        break;
+
+      case detail::shard_record::check:
+        if (m_state.recorder) {
+          detail::shard_check c;
+          std::memcpy(&c, payload, sizeof(c));
+          m_recorder.push(
+              check_result(j.group->name.c_str(), j.item, c.expr, c.file, c.line, c.end_time, c.success));
+        }
+        break;
+
+      case detail::shard_record::site:
+        if (m_state.recorder) {
+          detail::shard_site c;
+          std::memcpy(&c, payload, sizeof(c));
+          m_recorder.count_pass(detail::check_site_registry::get().intern(c.expr, c.file, c.line), c.passed);
+        }
+        break;
+
+      case detail::shard_record::timing:
+        if (m_state.timings) {
+          timing_record t;
+          detail::shard_timing h;
+          std::memcpy(&h, payload, sizeof(h));
+
+          t.group = j.group->name.c_str();
+          t.item = j.item;
+          t.benchmark = h.benchmark;
+          t.samples_ns.resize((r.size - sizeof(h)) / sizeof(double));
+          std::memcpy(t.samples_ns.data(), payload + sizeof(h), t.samples_ns.size() * sizeof(double));
+          m_state.timings->push_back(t);
+        }
+        break;
+
+      case detail::shard_record::end_test: {
+        detail::shard_end e;
+        std::memcpy(&e, payload, sizeof(e));
+
+        s.running = false;
+        s.next++;
+        std::cout.flush();
+
+        if (e.passed) {
+          m_state.passed_count++;
+        }
+        else {
+          m_state.failed_count++;
+        }
+
+        if (e.should_stop && !m_state.should_stop) {
+          m_state.should_stop = true;
+          m_state.current_group = j.group->name.c_str();
+          m_state.current_test = j.item->name;
 
-    static inline manager& get_instance() {
-      return *get_instance_ptr();
+          for (std::size_t i = 0; i < shards.size(); i++) {
+            if (&shards[i] != &s && shards[i].pid > 0) {
+              ::kill(shards[i].pid, SIGKILL);
+            }
+          }
+        }
+      } break;
+      }
     }
 
-    static inline state& state() { return get_instance().m_state; }
+    s.buffer.erase(0, pos);
+  }
+
+  void manager::end_shard(shard& s, std::vector<shard>& shards, const std::vector<job>& jobs) {
+    ::close(s.fd);
+    s.fd = -1;
 
-    static inline void add_test(
-        const char* group, const char* name, const char* desc, const char* opts, long flags, test_function fct) {
-      (void)opts;
-      test_vector& vec = get_instance().m_tests[group];
-      test_item item(name, desc, fct, flags);
-      vec.insert(std::upper_bound(vec.begin(), vec.end(), item, item_comparator()), NANO_TEST_MOVE(item));
+    int status = 0;
+    while (::waitpid(s.pid, &status, 0) < 0 && errno == EINTR) {
     }
+    s.pid = -1;
 
-    inline static int run(int argc, const char* argv[]);
-    inline static int run(int argc, const char* argv[], std::vector<check_result>& results);
+    if (m_state.should_stop) {
+      return;
+    }
 
-  private:
-    manager() = default;
+    if (!s.running) {
+      // Killed for a timeout just after its test ended, the other tests of the shard still have to run.
+      if (s.timed_out && s.next < s.jobs.size()) {
+        start_shard(s, shards, jobs);
+      }
+      return;
+    }
 
-    test_map m_tests;
-    struct state m_state;
+    // The shard died inside a test: report it and resume with the next one.
+    const job& j = jobs[s.jobs[s.next]];
+    s.running = false;
+    s.next++;
+    m_state.failed_count++;
 
-    inline int run_impl(int argc, const char* argv[], std::vector<check_result>* results);
+    if (s.timed_out) {
+      m_reporter->begin_test(std::cout, j.group->name.c_str(), *j.item);
+      m_reporter->test_timed_out(std::cout, j.group->name.c_str(), *j.item, s.timeout * 1e9);
+    }
+    else if (WIFSIGNALED(status)) {
+      m_reporter->test_crashed(
+          std::cout, j.group->name.c_str(), *j.item, "Test crashed with signal", WTERMSIG(status));
+    }
+    else {
+      m_reporter->test_crashed(
+          std::cout, j.group->name.c_str(), *j.item, "Test exited with status", WEXITSTATUS(status));
+    }
+    std::cout << std::flush;
 
-    struct item_comparator {
-      inline bool operator()(const test_item& a, const test_item& b) const { return a.name < b.name; }
-    };
+    if (m_state.recorder) {
+      m_recorder.push(
+          check_result(j.group->name.c_str(), j.item, s.timed_out ? "timed out" : "crashed", "", 0, 0, false));
+    }
 
-    static inline manager*& get_instance_ptr() {
-      NANO_TEST_CLANG_PUSH_WARNING("-Wexit-time-destructors")
-      static manager* tm = new manager();
-      return tm;
-      NANO_TEST_CLANG_POP_WARNING()
+    if (m_state.journal) {
+      if (s.timed_out) {
+        m_journal.timed_out(j.group->name.c_str(), j.item->name, s.timeout * 1e9);
+      }
+      else {
+        m_journal.crash(WIFSIGNALED(status) ? WTERMSIG(status) : 0, j.group->name.c_str(), j.item->name);
+      }
     }
-  };
 
-  // MARK: - Inline implementations -
+    if (s.next < s.jobs.size()) {
+      start_shard(s, shards, jobs);
+    }
+  }
 
-#ifdef NANO_TEST_CPP_98
-  template <typename T1, typename T2, typename T3>
-  inline bool is_approximately_equal(T1 a, T2 b, T3 tolerance) {
-    typedef typename detail::float_common_return<T1, T2>::type ftype;
+  int manager::kill_timed_out_shards(std::vector<shard>& shards) {
+    int wait_ms = -1;
 
-    const ftype fa = static_cast<ftype>(a);
-    const ftype fb = static_cast<ftype>(b);
-    const ftype t = static_cast<ftype>(tolerance);
-    return (std::abs(fa - fb) <= t) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * t));
-  }
+    for (std::size_t i = 0; i < shards.size(); i++) {
+      shard& s = shards[i];
+      if (!s.running || s.timed_out || s.timeout <= 0 || s.pid <= 0) {
+        continue;
+      }
 
-  template <typename T1, typename T2>
-  inline bool is_approximately_equal(T1 a, T2 b, double tolerance = std::numeric_limits<double>::epsilon()) {
-    typedef typename detail::float_common_return<T1, T2>::type ftype;
+      const double remaining_ms = 1e3 * s.timeout - 1e-6 * detail::clock::elapsed_ns(s.start_time);
+      if (remaining_ms <= 0) {
+        // The pipe is closed by the kill, end_shard reports the timeout and respawns the shard.
+        ::kill(s.pid, SIGKILL);
+        s.timed_out = true;
+        continue;
+      }
 
-    const ftype fa = static_cast<ftype>(a);
-    const ftype fb = static_cast<ftype>(b);
-    const ftype t = static_cast<ftype>(tolerance);
-    return (std::abs(fa - fb) <= t) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * t));
+      const int ms = static_cast<int>(std::min(std::ceil(remaining_ms), 1e9));
+      wait_ms = wait_ms < 0 ? ms : std::min(wait_ms, ms);
+    }
+
+    return wait_ms;
   }
+#endif // NANO_TEST_HAS_FORK
 
-#else
-  template <typename T1, typename T2>
-  inline bool is_approximately_equal(T1 a, T2 b,
-      typename detail::float_common_return<T1, T2>::type tolerance
-      = std::numeric_limits<typename detail::float_common_return<T1, T2>::type /**/>::epsilon()) {
-    typedef typename detail::float_common_return<T1, T2>::type ftype;
+  inline int run(int argc, const char* argv[]) { return manager::run(argc, argv); }
 
-    const ftype fa = static_cast<ftype>(a);
-    const ftype fb = static_cast<ftype>(b);
-    return (std::abs(fa - fb) <= tolerance) || (std::abs(fa - fb) < (std::max(std::abs(fa), std::abs(fb)) * tolerance));
+  inline int run(int argc, const char* argv[], std::vector<NANO_NAMESPACE::test::check_result>& results) {
+    return manager::run(argc, argv, results);
   }
+
+  /// Runs the tests and records the failed checks in full and the passing checks per call site.
+  inline int run(int argc, const char* argv[], check_summary& summary) { return manager::run(argc, argv, summary); }
+
+#ifdef NANO_TEST_HAS_THREADS
+  typedef manager::test_context test_context;
+  typedef manager::test_scope test_scope;
+
+  /// Test running on the calling thread, see test_scope.
+  inline test_context current_test() { return manager::current_test(); }
 #endif
 
-#define NANO_TEST_DECL_COMP(name, comp)                                                                                \
-  struct comp_##name {                                                                                                 \
-    template <typename T1, typename T2>                                                                                \
-    inline NANO_TEST_CONSTEXPR bool operator()(const T1& a, const T2& b) const {                                       \
-      return a comp b;                                                                                                 \
-    }                                                                                                                  \
-  }
+  inline void set_reporter(reporter* r) { manager::set_reporter(r); }
 
-  NANO_TEST_DECL_COMP(eq, ==);
-  NANO_TEST_DECL_COMP(ne, !=);
-  NANO_TEST_DECL_COMP(lt, <);
-  NANO_TEST_DECL_COMP(le, <=);
-  NANO_TEST_DECL_COMP(gt, >);
-  NANO_TEST_DECL_COMP(ge, >=);
+  /// Runs a BENCHMARK_CASE body with calibrated repetitions and reports its timing.
+  inline void run_benchmark(test_function fct) {
+    struct manager::state& s = manager::state();
 
-#undef NANO_TEST_DECL_COMP
+    benchmark_result r = detail::measure(fct, manager::get_benchmark_options());
+    r.group = s.current_group;
+    r.item = s.current_item;
+    s.reporter->benchmark(s.out(), r);
 
-  int manager::run(int argc, const char* argv[]) { return get_instance().run_impl(argc, argv, NANO_TEST_NULLPTR); }
+    if (s.journal) {
+      s.journal->benchmark(s.journal_test, r.samples_ns.size(), r.median_ns, r.iterations);
+    }
 
-  int manager::run(int argc, const char* argv[], std::vector<check_result>& results) {
-    return get_instance().run_impl(argc, argv, &results);
+    if (s.timings) {
+      timing_record t;
+      t.group = r.group;
+      t.item = r.item;
+      t.benchmark = true;
+      t.samples_ns = r.samples_ns;
+      s.timings->push_back(t);
+    }
   }
 
-  int manager::run_impl(int argc, const char* argv[], std::vector<check_result>* results) {
+#ifndef NANO_TEST_CPP_98
+  namespace detail {
+    template <typename Fct>
+    inline double measure_median_ns(Fct fct) {
+      return measure(fct, manager::get_benchmark_options()).median_ns;
+    }
+  } // namespace detail
 
-    argparse::argument_parser parser("utest", "Unit tests runner");
-    parser.add_argument("-v", "--verbose", "verbose", false).count(0);
-    parser.add_argument("-g", "--groups", "group tests to run", false);
-    parser.enable_help();
+  /// Implementation of EXPECT_WITHIN_BUDGET and EXPECT_FASTER_THAN.
+  /// Fails when the median time of fct is greater than ratio * reference_ns.
+  template <typename Fct>
+  inline void check_performance(const char* expr, Fct fct, double reference_ns, double ratio, const char* file,
+      std::size_t line, bool is_assert) {
+    struct manager::state& s = manager::state();
+    s.check_count++;
 
-    argparse::result err = parser.parse(argc, argv);
-    if (err) {
-      std::cout << err << std::endl;
-      return -1;
+    const double limit_ns = ratio * reference_ns;
+    const double median_ns = detail::measure_median_ns(fct);
+
+    if (median_ns <= limit_ns) {
+      s.add_check(true, expr, file, line);
+      return;
     }
 
-    if (parser.exists("help")) {
-      parser.print_help();
-      return 0;
+    s.add_check(false, expr, file, line);
+    s.performance_check_failed(expr, file, line, median_ns, limit_ns);
+
+    if (is_assert) {
+      throw failed_expect_exception<>(expr, file, static_cast<int>(line));
     }
 
-    const std::vector<std::string>* groups_ptr = NANO_TEST_NULLPTR;
-    const argparse::argument* groups_arg = parser.get_argument("groups");
-    if (groups_arg) {
-      const std::vector<std::string>& groups = groups_arg->get_values();
-      groups_ptr = &groups;
+    s.current_test_failed = true;
+    s.failed_check_count++;
+  }
+#endif
+
+  namespace detail {
+#ifdef NANO_TEST_CPP_98
+    template <typename T>
+    inline void print_value(std::ostream& os, const T& value) {
+      os << value;
     }
-    //    bool hasGroups = parser.get_argument("groups")->get_values()
+#else
+    template <typename T, typename = void>
+    struct is_streamable : std::false_type {};
 
-    if (results) {
-      m_state.results = results;
+    template <typename T>
+    struct is_streamable<T, decltype(void(std::declval<std::ostream&>() << std::declval<const T&>()))>
+        : std::true_type {};
+
+    template <typename T>
+    inline typename std::enable_if<is_streamable<T>::value && !(std::is_integral<T>::value && sizeof(T) == 1)>::type
+    print_value(std::ostream& os, const T& value) {
+      os << value;
     }
 
-    m_state.passed_count = 0;
-    m_state.failed_count = 0;
-    m_state.total_tests = 0;
-    m_state.should_stop = false;
+    /// Bytes of audio and image buffers are printed as numbers rather than characters.
+    template <typename T>
+    inline typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 1>::type print_value(
+        std::ostream& os, const T& value) {
+      os << static_cast<int>(value);
+    }
 
-    std::set<std::string> group_map;
+    template <typename T>
+    inline typename std::enable_if<!is_streamable<T>::value>::type print_value(std::ostream& os, const T&) {
+      os << "(not printable)";
+    }
+#endif
 
-    if (groups_ptr) {
-      for (std::size_t i = 0; i < groups_ptr->size(); i++) {
-        group_map.insert(groups_ptr->operator[](i));
+    template <typename T>
+    inline std::string value_to_string(const T& value) {
+      std::ostringstream ss;
+      if (std::numeric_limits<T>::is_iec559) {
+        ss.precision(std::numeric_limits<T>::digits10 + 3);
       }
+      print_value(ss, value);
+      return ss.str();
+    }
+
+    template <typename T1, typename T2>
+    NANO_TEST_COLD inline void range_failed(struct manager::state& s, const char* expr, const char* file,
+        std::size_t line, std::size_t index, const T1& a, const T2& b) {
+      s.range_expect_failed(expr, file, line, index, value_to_string(a), value_to_string(b));
+    }
+
+    template <typename T1, typename T2>
+    NANO_TEST_NORETURN NANO_TEST_COLD inline void throw_range_failed(
+        const char* expr, const char* file, int line, std::size_t index, const T1& a, const T2& b) {
+      std::ostringstream ss;
+      ss << expr << "\n      mismatch : [" << index << "] " << value_to_string(a) << " vs " << value_to_string(b);
+      throw failed_expect_exception<>(ss.str().c_str(), file, line);
+    }
+  } // namespace detail
+
+  namespace detail {
+    /// Scalar pass over a failed approximate range comparison.
+    /// With ulps the elements are compared by ulp distance, otherwise with the tolerance.
+    template <typename T1, typename T2>
+    inline range_error compute_range_error(
+        const T1* a, const T2* b, std::size_t size, double tolerance, unsigned long long max_ulps, bool ulps) {
+      typedef typename float_common_return<T1, T2>::type ftype;
 
-      for (test_map::const_iterator g = m_tests.begin(); g != m_tests.end(); ++g) {
-        if (group_map.find(g->first) != group_map.end()) {
-          m_state.total_tests += g->second.size();
+      range_error e;
+      double worst = -1;
+
+      for (std::size_t i = 0; i < size; i++) {
+        const ftype fa = static_cast<ftype>(a[i]);
+        const ftype fb = static_cast<ftype>(b[i]);
+        const unsigned long long distance = ulp_distance(fa, fb);
+
+        double abs_error = std::abs(static_cast<double>(fa) - static_cast<double>(fb));
+        if (abs_error != abs_error) {
+          abs_error = std::numeric_limits<double>::infinity();
+        }
+
+        const double scale = std::max(std::abs(static_cast<double>(fa)), std::abs(static_cast<double>(fb)));
+        const double rel_error = scale > 0 ? abs_error / scale : (abs_error > 0 ? abs_error : 0);
+
+        e.max_abs_error = std::max(e.max_abs_error, abs_error);
+        e.max_rel_error = std::max(e.max_rel_error, rel_error);
+        e.max_ulps = std::max(e.max_ulps, distance);
+
+        const bool mismatch = ulps ? distance > max_ulps : !is_close(fa, fb, static_cast<ftype>(tolerance));
+        const double error = ulps ? static_cast<double>(distance) : abs_error;
+        if (mismatch) {
+          if (error > worst) {
+            worst = error;
+            e.worst_index = i;
+          }
+          e.mismatch_count++;
         }
       }
+
+      return e;
     }
-    else {
-      for (test_map::const_iterator g = m_tests.begin(); g != m_tests.end(); ++g) {
-        m_state.total_tests += g->second.size();
-      }
+
+    template <typename T1, typename T2>
+    NANO_TEST_COLD inline void range_error_failed(struct manager::state& s, const char* expr, const char* file,
+        std::size_t line, const T1* a, const T2* b, std::size_t size, const range_error& e) {
+      s.range_error_expect_failed(
+          expr, file, line, size, e, value_to_string(a[e.worst_index]), value_to_string(b[e.worst_index]));
     }
 
-    std::cout << "[==========] Running " << m_state.total_tests << " " << state::test(m_state.total_tests) << " from "
-              << m_tests.size() << " test " << state::group(m_tests.size()) << ".\n\n";
+    template <typename T1, typename T2>
+    NANO_TEST_NORETURN NANO_TEST_COLD inline void throw_range_error_failed(const char* expr, const char* file, int line,
+        const T1* a, const T2* b, std::size_t size, const range_error& e) {
+      std::ostringstream ss;
+      ss << expr << "\n      mismatch : " << e.mismatch_count << " of " << size << " elements\n      worst    : ["
+         << e.worst_index << "] " << value_to_string(a[e.worst_index]) << " vs " << value_to_string(b[e.worst_index])
+         << "\n      max abs  : " << e.max_abs_error << "\n      max rel  : " << e.max_rel_error
+         << "\n      max ulps : " << e.max_ulps;
+      throw failed_expect_exception<>(ss.str().c_str(), file, line);
+    }
+
+    template <typename T1, typename T2>
+    inline std::size_t count_range_mismatches(
+        const T1* a, const T2* b, std::size_t size, double tolerance, unsigned long long max_ulps, bool ulps) {
+      typedef typename float_common_return<T1, T2>::type ftype;
+      return ulps ? count_ulp_mismatches(a, b, size, max_ulps)
+                  : tolerance_kernel<T1, T2>::count_mismatches(a, b, size, static_cast<ftype>(tolerance));
+    }
+  } // namespace detail
 
-    m_state.launch_start_time = state::clock::now();
+  /// Implementation of EXPECT_RANGE_FLOAT_EQ and EXPECT_RANGE_ULP_EQ, reports all the mismatches in one check.
+  template <typename T1, typename T2>
+  inline void check_range_error(struct manager::state& s, detail::check_site_id& site, const char* expr, const T1* a,
+      const T2* b, std::size_t size, double tolerance, unsigned long long max_ulps, bool ulps, const char* file,
+      std::size_t line) {
+    if (NANO_TEST_LIKELY(detail::count_range_mismatches(a, b, size, tolerance, max_ulps, ulps) == 0)) {
+      s.check_passed(site, expr, file, line);
+      return;
+    }
 
-    for (test_map::const_iterator g = m_tests.begin(); g != m_tests.end(); ++g) {
-      if (!group_map.empty() && group_map.find(g->first) == group_map.end()) {
-        continue;
-      }
+    detail::range_error_failed(
+        s, expr, file, line, a, b, size, detail::compute_range_error(a, b, size, tolerance, max_ulps, ulps));
+  }
 
-      m_state.start_group(*g);
+  /// Implementation of ASSERT_RANGE_FLOAT_EQ and ASSERT_RANGE_ULP_EQ.
+  template <typename T1, typename T2>
+  inline void assert_range_error(const char* expr, const T1* a, const T2* b, std::size_t size, double tolerance,
+      unsigned long long max_ulps, bool ulps, const char* file, int line) {
+    if (NANO_TEST_LIKELY(detail::count_range_mismatches(a, b, size, tolerance, max_ulps, ulps) == 0)) {
+      return;
+    }
 
-      for (test_vector::const_iterator t = g->second.begin(); t != g->second.end(); ++t) {
-        m_state.run_test(*t);
+    detail::throw_range_error_failed(
+        expr, file, line, a, b, size, detail::compute_range_error(a, b, size, tolerance, max_ulps, ulps));
+  }
 
-        if (m_state.should_stop) {
-          break;
-        }
+  /// Implementation of the EXPECT_RANGE macros, reports the first mismatching elements on failure.
+  template <typename Comp, typename T1, typename T2>
+  inline void check_range(struct manager::state& s, detail::check_site_id& site, const char* expr, const T1* a,
+      const T2* b, std::size_t size, const char* file, std::size_t line) {
+    const std::size_t index = find_range_mismatch<Comp>(a, b, size);
+    if (NANO_TEST_LIKELY(index == size)) {
+      s.check_passed(site, expr, file, line);
+      return;
+    }
+
+    detail::range_failed(s, expr, file, line, index, a[index], b[index]);
+  }
+
+  /// Implementation of the ASSERT_RANGE macros.
+  template <typename Comp, typename T1, typename T2>
+  inline void assert_range(const char* expr, const T1* a, const T2* b, std::size_t size, const char* file, int line) {
+    const std::size_t index = find_range_mismatch<Comp>(a, b, size);
+    if (NANO_TEST_LIKELY(index == size)) {
+      return;
+    }
+
+    detail::throw_range_failed(expr, file, line, index, a[index], b[index]);
+  }
+
+  namespace detail {
+    /// Maps the golden file, error is set when it cannot be read or does not hold size bytes.
+    inline bool open_golden(mapped_file& golden, const char* path, std::size_t size, std::string& error) {
+      if (!golden.open(path)) {
+        error = "cannot read the file";
+        return false;
       }
 
-      m_state.end_group(*g);
+      if (golden.size() != size) {
+        std::ostringstream ss;
+        ss << "file size " << golden.size() << " bytes, expected " << size << " bytes";
+        error = ss.str();
+        return false;
+      }
 
-      if (m_state.should_stop) {
-        std::cout << "\n[==========] Stopped in test case '" << m_state.current_test << "' from '"
-                  << m_state.current_group << "' group.\n\n"
-                  << std::endl;
+      return true;
+    }
 
-        break;
+    NANO_TEST_NORETURN NANO_TEST_COLD inline void throw_golden_failed(
+        const char* expr, const char* path, const std::string& error, const char* file, int line) {
+      std::ostringstream ss;
+      ss << expr << "\n      golden   : " << path << "\n      error    : " << error;
+      throw failed_expect_exception<>(ss.str().c_str(), file, line);
+    }
+
+    template <typename Buffer>
+    inline const unsigned char* buffer_bytes(const Buffer& buffer) {
+      return buffer.empty() ? NANO_TEST_NULLPTR : reinterpret_cast<const unsigned char*>(&buffer[0]);
+    }
+
+    template <typename Buffer>
+    inline std::size_t buffer_size(const Buffer& buffer) {
+      return buffer.size() * sizeof(buffer[0]);
+    }
+  } // namespace detail
+
+  /// Implementation of EXPECT_RANGE_EQ_FILE, compares the range with the elements stored in a golden file.
+  /// The file is mapped and compared in place, with --update-golden the range is written to it instead.
+  template <typename Comp, typename T>
+  inline void check_range_file(struct manager::state& s, detail::check_site_id& site, const char* expr, const T* a,
+      std::size_t size, const char* path, const char* file, std::size_t line) {
+    if (s.update_golden) {
+      if (detail::write_file_atomic(path, a, size * sizeof(T))) {
+        s.check_passed(site, expr, file, line);
+      }
+      else {
+        s.golden_expect_failed(expr, path, "cannot write the file", file, line);
       }
+      return;
     }
 
-    std::cout << "[==========] " << m_state.total_tests << " " << state::test(m_state.total_tests) << " from "
-              << m_tests.size() << " test " << state::group(m_tests.size()) << " (" << m_state.launch_us() << " us)."
-              << std::endl;
+    detail::mapped_file golden;
+    std::string error;
+    if (!detail::open_golden(golden, path, size * sizeof(T), error)) {
+      s.golden_expect_failed(expr, path, error, file, line);
+      return;
+    }
+
+    check_range<Comp>(s, site, expr, a, reinterpret_cast<const T*>(golden.data()), size, file, line);
+  }
 
-    std::cout << "[  PASSED  ] " << m_state.passed_count << " " << state::test(m_state.passed_count) << std::endl;
+  /// Implementation of ASSERT_RANGE_EQ_FILE.
+  template <typename Comp, typename T>
+  inline void assert_range_file(struct manager::state& s, const char* expr, const T* a, std::size_t size,
+      const char* path, const char* file, int line) {
+    if (s.update_golden) {
+      if (!detail::write_file_atomic(path, a, size * sizeof(T))) {
+        detail::throw_golden_failed(expr, path, "cannot write the file", file, line);
+      }
+      return;
+    }
 
-    if (m_state.failed_count) {
-      std::cout << "[  FAILED  ] " << m_state.failed_count << " " << state::test(m_state.failed_count) << std::endl;
+    detail::mapped_file golden;
+    std::string error;
+    if (!detail::open_golden(golden, path, size * sizeof(T), error)) {
+      detail::throw_golden_failed(expr, path, error, file, line);
     }
 
-    return static_cast<int>(m_state.failed_count);
+    assert_range<Comp>(expr, a, reinterpret_cast<const T*>(golden.data()), size, file, line);
   }
 
-  inline int run(int argc, const char* argv[]) { return manager::run(argc, argv); }
+  /// Implementation of EXPECT_MATCHES_GOLDEN, the bytes of the buffer must be identical to the file.
+  template <typename Buffer>
+  inline void check_golden(struct manager::state& s, detail::check_site_id& site, const char* expr,
+      const Buffer& buffer, const char* path, const char* file, std::size_t line) {
+    check_range_file<comp_eq>(
+        s, site, expr, detail::buffer_bytes(buffer), detail::buffer_size(buffer), path, file, line);
+  }
 
-  inline int run(int argc, const char* argv[], std::vector<NANO_NAMESPACE::test::check_result>& results) {
-    return manager::run(argc, argv, results);
+  /// Implementation of ASSERT_MATCHES_GOLDEN.
+  template <typename Buffer>
+  inline void assert_golden(
+      struct manager::state& s, const char* expr, const Buffer& buffer, const char* path, const char* file, int line) {
+    assert_range_file<comp_eq>(s, expr, detail::buffer_bytes(buffer), detail::buffer_size(buffer), path, file, line);
   }
 
   inline void release() { manager::release_instance(); }
@@ -1374,19 +7443,16 @@ namespace test {
 
 #define NANO_TEST_EXPECT_IMPL(S, Expr)                                                                                 \
   do {                                                                                                                 \
+    static NANO_NAMESPACE::test::detail::check_site_id _nano_site(0);                                                  \
     struct NANO_NAMESPACE::test::manager::state& _nano_state = NANO_NAMESPACE::test::manager::state();                 \
     NANO_TEST_MSVC_PUSH_WARNING(4127)                                                                                  \
     try {                                                                                                              \
       _nano_state.check_count++;                                                                                       \
-      if (!(Expr)) {                                                                                                   \
-        _nano_state.current_test_failed = true;                                                                        \
-        _nano_state.failed_check_count++;                                                                              \
-        _nano_state.add_check(false, S, __FILE__, __LINE__);                                                           \
-        std::cout << "    > Check failed\n      expected : " << S << "\n      source   : " << __FILE__                 \
-                  << "\n      line     : " << __LINE__ << "\n";                                                        \
+      if (NANO_TEST_LIKELY(Expr)) {                                                                                    \
+        _nano_state.check_passed(_nano_site, S, __FILE__, __LINE__);                                                   \
       }                                                                                                                \
       else {                                                                                                           \
-        _nano_state.add_check(true, S, __FILE__, __LINE__);                                                            \
+        _nano_state.expect_failed(S, __FILE__, __LINE__);                                                              \
       }                                                                                                                \
     } catch (const std::exception& e) {                                                                                \
       throw e;                                                                                                         \
@@ -1408,30 +7474,20 @@ namespace test {
     }                                                                                                                  \
                                                                                                                        \
     if (exception_caught != 1) {                                                                                       \
-      _nano_state.current_test_failed = true;                                                                          \
-      _nano_state.failed_check_count++;                                                                                \
-      std::cout << "    > Check exception failed\n      expected : " << NANO_TEST_STRINGIFY(exception_type)            \
-                << "\n      got      : " << (exception_caught == 2 ? "unexpected exception" : "no exception")          \
-                << "\n      source   : " << __FILE__ << "\n      line     : " << __LINE__ << "\n";                     \
+      _nano_state.expect_exception_failed(                                                                             \
+          NANO_TEST_STRINGIFY(exception_type), exception_caught == 2, __FILE__, __LINE__);                             \
     }                                                                                                                  \
   } while (0)
 
 #define NANO_TEST_EXPECT_RANGE_IMPL(S, A, B, Size, Comp)                                                               \
   do {                                                                                                                 \
     NANO_TEST_MSVC_PUSH_WARNING(4127)                                                                                  \
+    static NANO_NAMESPACE::test::detail::check_site_id _nano_site(0);                                                  \
     struct NANO_NAMESPACE::test::manager::state& _nano_state = NANO_NAMESPACE::test::manager::state();                 \
     try {                                                                                                              \
       _nano_state.check_count++;                                                                                       \
-      if (!NANO_NAMESPACE::test::compare_range<Comp>(A, B, static_cast<std::size_t>(Size))) {                          \
-        _nano_state.current_test_failed = true;                                                                        \
-        _nano_state.failed_check_count++;                                                                              \
-        _nano_state.add_check(false, S, __FILE__, __LINE__);                                                           \
-        std::cout << "    > Check failed\n      expected : " << S << "\n      source   : " << __FILE__                 \
-                  << "\n      line     : " << __LINE__ << "\n";                                                        \
-      }                                                                                                                \
-      else {                                                                                                           \
-        _nano_state.add_check(true, S, __FILE__, __LINE__);                                                            \
-      }                                                                                                                \
+      NANO_NAMESPACE::test::check_range<Comp>(                                                                         \
+          _nano_state, _nano_site, S, A, B, static_cast<std::size_t>(Size), __FILE__, __LINE__);                       \
     } catch (const std::exception& e) {                                                                                \
       throw e;                                                                                                         \
     }                                                                                                                  \
@@ -1444,8 +7500,42 @@ namespace test {
 
 #define NANO_TEST_ASSERT_RANGE_IMPL(S, A, B, Size, Comp)                                                               \
   NANO_NAMESPACE::test::manager::state().check_count++;                                                                \
-  NANO_NAMESPACE::test::custom_assert(                                                                                 \
-      S, NANO_NAMESPACE::test::compare_range<Comp>(A, B, static_cast<std::size_t>(Size)), __FILE__, __LINE__)
+  NANO_NAMESPACE::test::assert_range<Comp>(S, A, B, static_cast<std::size_t>(Size), __FILE__, __LINE__)
+
+#define NANO_TEST_EXPECT_RANGE_ERROR_IMPL(S, A, B, Size, Tolerance, MaxUlps, Ulps)                                     \
+  do {                                                                                                                 \
+    NANO_TEST_MSVC_PUSH_WARNING(4127)                                                                                  \
+    static NANO_NAMESPACE::test::detail::check_site_id _nano_site(0);                                                  \
+    struct NANO_NAMESPACE::test::manager::state& _nano_state = NANO_NAMESPACE::test::manager::state();                 \
+    _nano_state.check_count++;                                                                                         \
+    NANO_NAMESPACE::test::check_range_error(_nano_state, _nano_site, S, A, B, static_cast<std::size_t>(Size),          \
+        Tolerance, MaxUlps, Ulps, __FILE__, __LINE__);                                                                 \
+    NANO_TEST_MSVC_POP_WARNING()                                                                                       \
+  } while (0)
+
+#define NANO_TEST_ASSERT_RANGE_ERROR_IMPL(S, A, B, Size, Tolerance, MaxUlps, Ulps)                                     \
+  NANO_NAMESPACE::test::manager::state().check_count++;                                                                \
+  NANO_NAMESPACE::test::assert_range_error(                                                                            \
+      S, A, B, static_cast<std::size_t>(Size), Tolerance, MaxUlps, Ulps, __FILE__, __LINE__)
+
+#define NANO_TEST_EXPECT_GOLDEN_IMPL(S, Check, ...)                                                                    \
+  do {                                                                                                                 \
+    NANO_TEST_MSVC_PUSH_WARNING(4127)                                                                                  \
+    static NANO_NAMESPACE::test::detail::check_site_id _nano_site(0);                                                  \
+    struct NANO_NAMESPACE::test::manager::state& _nano_state = NANO_NAMESPACE::test::manager::state();                 \
+    _nano_state.check_count++;                                                                                         \
+    NANO_NAMESPACE::test::Check(_nano_state, _nano_site, S, __VA_ARGS__, __FILE__, __LINE__);                          \
+    NANO_TEST_MSVC_POP_WARNING()                                                                                       \
+  } while (0)
+
+#define NANO_TEST_ASSERT_GOLDEN_IMPL(S, Check, ...)                                                                    \
+  do {                                                                                                                 \
+    NANO_TEST_MSVC_PUSH_WARNING(4127)                                                                                  \
+    struct NANO_NAMESPACE::test::manager::state& _nano_state = NANO_NAMESPACE::test::manager::state();                 \
+    _nano_state.check_count++;                                                                                         \
+    NANO_NAMESPACE::test::Check(_nano_state, S, __VA_ARGS__, __FILE__, __LINE__);                                      \
+    NANO_TEST_MSVC_POP_WARNING()                                                                                       \
+  } while (0)
 
 #define NANO_TEST_ASSERT_EXCEPTION_IMPL(Expr, exception_type)                                                          \
   do {                                                                                                                 \
@@ -1467,35 +7557,60 @@ namespace test {
     }                                                                                                                  \
   } while (0)
 
-#ifdef _MSC_VER
-  #define NANO_TEST_CASE_IMPL(group, name, desc, opts, flags)                                                          \
-    void name();                                                                                                       \
+#define NANO_TEST_CASE_IMPL(group, name, desc, opts, flags)                                                            \
+  void name();                                                                                                         \
+  NANO_TEST_REGISTER_IMPL(group, name, #name, desc, opts, flags)                                                       \
+  void name()
+
+#define NANO_TEST_BENCHMARK_CASE_IMPL(group, name, desc, flags)                                                        \
+  void name();                                                                                                         \
+  void name##_benchmark() { NANO_NAMESPACE::test::run_benchmark(&name); }                                              \
+  NANO_TEST_REGISTER_IMPL(group, name##_benchmark, #name, desc, "", (flags) | NANO_TEST_BENCHMARK)                     \
+  void name()
+
+#if defined(NANO_TEST_HAS_SECTION_REGISTRATION)
+  // Constant initialized, registering a test runs no code and allocates nothing before main.
+  // The explicit alignment stops the compiler from padding the records, the section is read as an array.
+  #define NANO_TEST_REGISTER_IMPL(group, fct, name_str, desc, opts, flags)                                             \
+    namespace _unit_tests_ {                                                                                           \
+      namespace {                                                                                                      \
+        __attribute__((used, section("nano_test_records"), aligned(__alignof__(NANO_NAMESPACE::test::test_record))))   \
+        const NANO_NAMESPACE::test::test_record fct##_TestRecord                                                       \
+            = { group, { name_str, desc, &fct, flags, __FILE__, __LINE__ } };                                          \
+      } /* namespace */                                                                                                \
+    } /* namespace _unit_tests_ */
+
+#elif defined(_MSC_VER)
+  #define NANO_TEST_REGISTER_IMPL(group, fct, name_str, desc, opts, flags)                                             \
     namespace _unit_tests_ {                                                                                           \
       namespace {                                                                                                      \
-        struct name##_TestRegistration {                                                                               \
-          inline name##_TestRegistration() {                                                                           \
-            NANO_NAMESPACE::test::manager::add_test(group, #name, desc, opts, flags, &name);                           \
+        struct fct##_TestRegistration {                                                                                \
+          inline fct##_TestRegistration() {                                                                            \
+            NANO_NAMESPACE::test::manager::add_test(group, name_str, desc, opts, flags, &fct, __FILE__, __LINE__);     \
           }                                                                                                            \
         };                                                                                                             \
-        static name##_TestRegistration name##_testRegistration = name##_TestRegistration{};                            \
+        static fct##_TestRegistration fct##_testRegistration = fct##_TestRegistration{};                               \
       } /* namespace */                                                                                                \
-    } /* namespace _unit_tests_ */                                                                                     \
-    void name()
+    } /* namespace _unit_tests_ */
 
 #else
-  #define NANO_TEST_CASE_IMPL(group, name, desc, opts, flags)                                                          \
-    void name();                                                                                                       \
+  #define NANO_TEST_REGISTER_IMPL(group, fct, name_str, desc, opts, flags)                                             \
     namespace _unit_tests_ {                                                                                           \
       namespace {                                                                                                      \
-        __attribute__((constructor)) static void name##_TestRegistration() {                                           \
-          NANO_NAMESPACE::test::manager::add_test(group, #name, desc, opts, flags, &name);                             \
+        __attribute__((constructor)) static void fct##_TestRegistration() {                                            \
+          NANO_NAMESPACE::test::manager::add_test(group, name_str, desc, opts, flags, &fct, __FILE__, __LINE__);       \
         }                                                                                                              \
       } /* namespace */                                                                                                \
-    } /* namespace _unit_tests_ */                                                                                     \
-    void name()
+    } /* namespace _unit_tests_ */
 
 #endif
 
+#define NANO_TEST_TIMED_FCT(Expr)                                                                                      \
+  [&]() { (Expr), NANO_NAMESPACE::test::detail::result_sink(); }
+
+#define NANO_TEST_PERFORMANCE_IMPL(S, Fct, ReferenceNs, Ratio, IsAssert)                                               \
+  NANO_NAMESPACE::test::check_performance(S, Fct, ReferenceNs, Ratio, __FILE__, __LINE__, IsAssert)
+
 #define NANO_TEST_ABORT_IMPL() NANO_NAMESPACE::test::manager::state().should_stop = true;
 
 NANO_TEST_MSVC_POP_WARNING() // 4514 5045
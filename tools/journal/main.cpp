@@ -0,0 +1,489 @@
+// Decodes the --journal file of a nano-test run into text, JSON or JUnit XML.
+//
+//   nano-test-journal [--format text|json|junit] [--follow] <journal>
+//
+// The journal can be read while the tests still run, or after the run crashed: reading stops at the first
+// record that is not written yet. With --follow the text format prints every test as it ends and waits for
+// the end of the run, which a crash or a timeout also writes. Exits with 1 when the run did not complete.
+
+#include "nano/test.h"
+
+#include <chrono>
+#include <thread>
+
+namespace {
+typedef nano::test::detail::journal_record record;
+
+struct failure {
+  std::string expr;
+  std::string file;
+  unsigned int line;
+};
+
+struct test_entry {
+  test_entry()
+      : status(running)
+      , ns(0)
+      , checks(0)
+      , failed_checks(0)
+      , signal(0)
+      , timeout_ns(0)
+      , samples(0)
+      , iterations(0)
+      , median_ns(0) {}
+
+  enum status_type { running, passed, failed, crashed, timed_out };
+
+  std::string group;
+  std::string name;
+  status_type status;
+  unsigned long long ns;
+  unsigned long long checks;
+  unsigned long long failed_checks;
+  std::vector<failure> failures;
+  unsigned int signal;
+  unsigned long long timeout_ns;
+  unsigned long long samples;
+  unsigned long long iterations;
+  double median_ns;
+};
+
+/// Reads the records of a journal in order, waiting for the ones not written yet when following.
+class journal_reader {
+public:
+  journal_reader()
+      : m_position(0)
+      , m_index(0) {}
+
+  bool open(const std::string& path) {
+    m_file.close();
+    m_file.clear();
+    m_file.open(path.c_str(), std::ios::binary);
+
+    char header[sizeof(record)];
+    if (!m_file.read(header, sizeof(header)) || std::memcmp(header, "NTJOURNL", 8) != 0) {
+      return false;
+    }
+
+    unsigned int version = 0;
+    unsigned int record_size = 0;
+    std::memcpy(&version, header + 8, sizeof(version));
+    std::memcpy(&record_size, header + 12, sizeof(record_size));
+
+    m_position = sizeof(record);
+    m_index = 1;
+    return version == nano::test::detail::journal::version && record_size == sizeof(record);
+  }
+
+  /// Reads the next record and, for a string record, its bytes. Returns false at the first empty record.
+  bool next(record& r, std::string& str) {
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(m_position));
+    if (!m_file.read(reinterpret_cast<char*>(&r), sizeof(r)) || r.type == record::empty) {
+      return false;
+    }
+
+    std::size_t count = 1;
+    if (r.type == record::string) {
+      // The bytes are complete once the string record is written.
+      count += (r.a + sizeof(record) - 1) / sizeof(record);
+      str.resize(r.a);
+      if (r.a && !m_file.read(&str[0], static_cast<std::streamsize>(r.a))) {
+        return false;
+      }
+    }
+
+    m_position += count * sizeof(record);
+    m_index += count;
+    return true;
+  }
+
+  /// Index of the record following the last one read.
+  unsigned long long index() const { return m_index; }
+
+private:
+  std::ifstream m_file;
+  std::size_t m_position;
+  unsigned long long m_index;
+};
+
+class journal_decoder {
+public:
+  journal_decoder()
+      : m_passed(0)
+      , m_failed(0)
+      , m_ns(0)
+      , m_complete(false)
+      , m_aborted(false) {}
+
+  /// Applies a record, returns the test it ended, if any.
+  const test_entry* apply(unsigned long long index, const record& r, const std::string& str) {
+    switch (r.type) {
+    case record::string:
+      m_strings[index] = str;
+      return NANO_TEST_NULLPTR;
+
+    case record::begin_test: {
+      m_tests.push_back(test_entry());
+      test_entry& t = m_tests.back();
+      t.group = string(r.b);
+      t.name = string(r.c);
+      m_by_record[index] = m_tests.size() - 1;
+      return NANO_TEST_NULLPTR;
+    }
+
+    case record::check_failed:
+      if (test_entry* t = test(r.b)) {
+        failure f;
+        f.expr = string(r.c);
+        f.file = string(r.d);
+        f.line = r.a;
+        t->failures.push_back(f);
+      }
+      return NANO_TEST_NULLPTR;
+
+    case record::end_test:
+      if (test_entry* t = test(r.b)) {
+        t->status = r.a ? test_entry::passed : test_entry::failed;
+        t->ns = r.c;
+        t->checks = r.d >> 32;
+        t->failed_checks = r.d & 0xFFFFFFFFULL;
+        return t;
+      }
+      return NANO_TEST_NULLPTR;
+
+    case record::crash:
+    case record::timed_out: {
+      test_entry& t = running_test(string(r.b), string(r.c));
+      t.status = r.type == record::crash ? test_entry::crashed : test_entry::timed_out;
+      t.signal = r.a;
+      t.timeout_ns = r.d;
+      return &t;
+    }
+
+    case record::benchmark:
+      if (test_entry* t = test(r.b)) {
+        t->samples = r.a;
+        t->iterations = r.d;
+        std::memcpy(&t->median_ns, &r.c, sizeof(t->median_ns));
+      }
+      return NANO_TEST_NULLPTR;
+
+    case record::end_run:
+      m_passed = r.b;
+      m_failed = r.c;
+      m_ns = r.d;
+      m_complete = true;
+      m_aborted = r.a != 0;
+
+      // A crash handler does not know the totals, the tests that did not pass count as failed.
+      if (m_aborted) {
+        m_passed = m_tests.size() - failure_count("");
+        m_failed = failure_count("");
+      }
+      return NANO_TEST_NULLPTR;
+
+    default:
+      return NANO_TEST_NULLPTR;
+    }
+  }
+
+  bool complete() const { return m_complete; }
+
+  /// True when the run ended on a crash or a timeout.
+  bool aborted() const { return m_aborted; }
+
+  void print_text_test(std::ostream& os, const test_entry& t) const {
+    static const char* const labels[] = { "[ RUNNING  ]", "[       OK ]", "[  FAILED  ]", "[ CRASHED  ]",
+      "[ TIMEOUT  ]" };
+
+    os << labels[t.status] << " " << t.group << "." << t.name;
+    if (t.status == test_entry::crashed) {
+      os << " (signal " << t.signal << ")";
+    }
+    else if (t.status == test_entry::timed_out) {
+      os << " (after ";
+      nano::test::detail::print_ns(os, static_cast<double>(t.timeout_ns));
+      os << ")";
+    }
+    else if (t.status != test_entry::running) {
+      os << " (" << (t.checks - t.failed_checks) << "/" << t.checks << " checks, ";
+      nano::test::detail::print_ns(os, static_cast<double>(t.ns));
+      os << ")";
+    }
+    os << "\n";
+
+    for (std::size_t i = 0; i < t.failures.size(); i++) {
+      const failure& f = t.failures[i];
+      if (f.file.empty()) {
+        os << f.expr;
+      }
+      else {
+        os << "    > " << f.file << ":" << f.line << ": " << f.expr << "\n";
+      }
+    }
+
+    if (t.samples) {
+      os << "    > Benchmark : median ";
+      nano::test::detail::print_ns(os, t.median_ns);
+      os << " (" << t.samples << " x " << t.iterations << " iterations)\n";
+    }
+  }
+
+  void print_text_summary(std::ostream& os) const {
+    if (!m_complete) {
+      for (std::size_t i = 0; i < m_tests.size(); i++) {
+        if (m_tests[i].status == test_entry::running) {
+          print_text_test(os, m_tests[i]);
+        }
+      }
+
+      os << "[==========] Incomplete run, " << m_tests.size() << " tests started.\n";
+      return;
+    }
+
+    if (m_aborted) {
+      os << "[ ABORTED  ] The run stopped on a crash or a timeout.\n";
+    }
+
+    os << "[==========] " << (m_passed + m_failed) << " tests (";
+    nano::test::detail::print_ns(os, static_cast<double>(m_ns));
+    os << ").\n";
+    os << "[  PASSED  ] " << m_passed << "\n";
+    if (m_failed) {
+      os << "[  FAILED  ] " << m_failed << "\n";
+    }
+  }
+
+  void print_json(std::ostream& os) const {
+    static const char* const statuses[] = { "running", "passed", "failed", "crashed", "timed_out" };
+
+    os << "{\"complete\":" << (m_complete ? "true" : "false") << ",\"aborted\":" << (m_aborted ? "true" : "false")
+       << ",\"passed\":" << m_passed
+       << ",\"failed\":" << m_failed << ",\"duration_ns\":" << m_ns << ",\"tests\":[";
+
+    for (std::size_t i = 0; i < m_tests.size(); i++) {
+      const test_entry& t = m_tests[i];
+      os << (i ? ",\n" : "\n") << "{\"group\":";
+      nano::test::detail::write_json_string(os, t.group.c_str());
+      os << ",\"name\":";
+      nano::test::detail::write_json_string(os, t.name.c_str());
+      os << ",\"status\":\"" << statuses[t.status] << "\",\"duration_ns\":" << t.ns << ",\"checks\":" << t.checks
+         << ",\"failed_checks\":" << t.failed_checks;
+
+      if (t.status == test_entry::crashed) {
+        os << ",\"signal\":" << t.signal;
+      }
+      else if (t.status == test_entry::timed_out) {
+        os << ",\"timeout_ns\":" << t.timeout_ns;
+      }
+
+      if (t.samples) {
+        os << ",\"benchmark\":{\"samples\":" << t.samples << ",\"iterations\":" << t.iterations
+           << ",\"median_ns\":" << t.median_ns << "}";
+      }
+
+      os << ",\"failures\":[";
+      for (std::size_t k = 0; k < t.failures.size(); k++) {
+        const failure& f = t.failures[k];
+        os << (k ? "," : "") << "{\"expr\":";
+        nano::test::detail::write_json_string(os, f.expr.c_str());
+        os << ",\"file\":";
+        nano::test::detail::write_json_string(os, f.file.c_str());
+        os << ",\"line\":" << f.line << "}";
+      }
+      os << "]}";
+    }
+
+    os << "\n]}\n";
+  }
+
+  void print_junit(std::ostream& os) const {
+    // Groups in the order of their first test.
+    std::vector<std::string> groups;
+    for (std::size_t i = 0; i < m_tests.size(); i++) {
+      if (std::find(groups.begin(), groups.end(), m_tests[i].group) == groups.end()) {
+        groups.push_back(m_tests[i].group);
+      }
+    }
+
+    os << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    os << "<testsuites tests=\"" << m_tests.size() << "\" failures=\"" << failure_count("") << "\" time=\""
+       << seconds(m_ns) << "\">\n";
+
+    for (std::size_t g = 0; g < groups.size(); g++) {
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < m_tests.size(); i++) {
+        count += m_tests[i].group == groups[g];
+      }
+
+      os << "  <testsuite name=\"";
+      nano::test::detail::write_xml_string(os, groups[g].c_str());
+      os << "\" tests=\"" << count << "\" failures=\"" << failure_count(groups[g]) << "\">\n";
+
+      for (std::size_t i = 0; i < m_tests.size(); i++) {
+        const test_entry& t = m_tests[i];
+        if (t.group != groups[g]) {
+          continue;
+        }
+
+        os << "    <testcase classname=\"";
+        nano::test::detail::write_xml_string(os, t.group.c_str());
+        os << "\" name=\"";
+        nano::test::detail::write_xml_string(os, t.name.c_str());
+        os << "\" time=\"" << seconds(t.ns) << "\">\n";
+
+        for (std::size_t k = 0; k < t.failures.size(); k++) {
+          os << "      <failure message=\"";
+          nano::test::detail::write_xml_string(os, t.failures[k].expr.c_str());
+          os << "\">";
+          if (!t.failures[k].file.empty()) {
+            nano::test::detail::write_xml_string(os, t.failures[k].file.c_str());
+            os << ":" << t.failures[k].line;
+          }
+          os << "</failure>\n";
+        }
+
+        if (t.status == test_entry::crashed) {
+          os << "      <error message=\"crashed with signal " << t.signal << "\"/>\n";
+        }
+        else if (t.status == test_entry::timed_out) {
+          os << "      <error message=\"timed out after " << seconds(t.timeout_ns) << " s\"/>\n";
+        }
+        else if (t.status == test_entry::running) {
+          os << "      <error message=\"did not end\"/>\n";
+        }
+
+        os << "    </testcase>\n";
+      }
+
+      os << "  </testsuite>\n";
+    }
+
+    os << "</testsuites>\n";
+  }
+
+private:
+  std::map<unsigned long long, std::string> m_strings;
+  std::map<unsigned long long, std::size_t> m_by_record;
+  std::vector<test_entry> m_tests;
+  unsigned long long m_passed;
+  unsigned long long m_failed;
+  unsigned long long m_ns;
+  bool m_complete;
+  bool m_aborted;
+
+  std::string string(unsigned long long index) const {
+    std::map<unsigned long long, std::string>::const_iterator it = m_strings.find(index);
+    return it == m_strings.end() ? std::string() : it->second;
+  }
+
+  test_entry* test(unsigned long long begin_record) {
+    std::map<unsigned long long, std::size_t>::const_iterator it = m_by_record.find(begin_record);
+    return it == m_by_record.end() ? NANO_TEST_NULLPTR : &m_tests[it->second];
+  }
+
+  /// Last test of that name still running. Crashes of shard processes are written by the runner, with
+  /// strings of its own, so the test is found by name.
+  test_entry& running_test(const std::string& group, const std::string& name) {
+    for (std::size_t i = m_tests.size(); i-- > 0;) {
+      if (m_tests[i].status == test_entry::running && m_tests[i].group == group && m_tests[i].name == name) {
+        return m_tests[i];
+      }
+    }
+
+    m_tests.push_back(test_entry());
+    m_tests.back().group = group;
+    m_tests.back().name = name;
+    return m_tests.back();
+  }
+
+  std::size_t failure_count(const std::string& group) const {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < m_tests.size(); i++) {
+      count += (group.empty() || m_tests[i].group == group) && m_tests[i].status != test_entry::passed;
+    }
+    return count;
+  }
+
+  static double seconds(unsigned long long ns) { return 1e-9 * static_cast<double>(ns); }
+};
+} // namespace.
+
+int main(int argc, const char* argv[]) {
+  argparse::argument_parser parser("nano-test-journal", "Decodes the --journal file of a nano-test run");
+  parser.add_argument("journal", "journal file", true).position(argparse::argument::LAST);
+  parser.add_argument("-f", "--format", "text, json or junit (default: text)", false).count(1);
+  parser.add_argument("--follow", "wait for the records of a run in progress", false).count(0);
+  parser.enable_help();
+
+  argparse::result err = parser.parse(argc, argv);
+  if (err) {
+    std::cout << err << std::endl;
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  const std::string path = parser.get_argument("journal")->get_values()[0];
+  const argparse::argument* format_arg = parser.get_argument("format");
+  const std::string format = format_arg ? format_arg->get_values()[0] : "text";
+  const bool follow = parser.exists("follow");
+  const bool stream_text = format == "text";
+
+  if (format != "text" && format != "json" && format != "junit") {
+    std::cout << "Unknown format '" << format << "', expected text, json or junit" << std::endl;
+    return -1;
+  }
+
+  journal_reader reader;
+  bool opened = reader.open(path);
+
+  // The runner may not have created the file yet.
+  for (int i = 0; follow && !opened && i < 100; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    opened = reader.open(path);
+  }
+
+  if (!opened) {
+    std::cout << "'" << path << "' is not a journal of this version" << std::endl;
+    return -1;
+  }
+
+  journal_decoder decoder;
+  record r;
+  std::string str;
+
+  while (!decoder.complete()) {
+    const unsigned long long index = reader.index();
+    if (!reader.next(r, str)) {
+      if (!follow) {
+        break;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+
+    const test_entry* ended = decoder.apply(index, r, str);
+    if (ended && stream_text) {
+      decoder.print_text_test(std::cout, *ended);
+      std::cout.flush();
+    }
+  }
+
+  if (stream_text) {
+    decoder.print_text_summary(std::cout);
+  }
+  else if (format == "json") {
+    decoder.print_json(std::cout);
+  }
+  else {
+    decoder.print_junit(std::cout);
+  }
+
+  return decoder.complete() && !decoder.aborted() ? 0 : 1;
+}